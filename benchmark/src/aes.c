@@ -9,6 +9,7 @@
  */
 
 #include "aes.h"
+#include "cpufeatures.h"
 
 /*
  * Notes on chosen AES implementations:
@@ -30,6 +31,19 @@
  * The 1024-byte tables combine the SubBytes (or InvSubBytes) and MixColumns (or
  * InvMixColumns) steps.  Normally 4096-byte tables would be needed for this,
  * but since rotations are "free" in ARM assembly only the first part is needed.
+ *
+ * For x86_64: if the CPU supports AES-NI (checked at runtime), single blocks
+ * use AESENC/AESDEC and AES-XTS processes 4 blocks at a time to hide the
+ * latency of those instructions.  If the CPU also supports VAES and VPCLMULQDQ,
+ * AES-XTS instead processes 8 blocks at a time in 256-bit registers, with the
+ * tweaks advanced by x^8 using carryless multiplication.  These all need the
+ * plain key schedule from aesti_expand_key(), not the one from aesti_set_key()
+ * which has S-box values mixed in for aesti_encrypt()'s prefetching.
+ *
+ * For ARM64: if the CPU supports the ARMv8 Crypto Extensions (checked at
+ * runtime), we use AESE/AESD with all the round keys held in registers, and
+ * AES-XTS processes 4 blocks at a time.  As on x86_64, this uses the plain key
+ * schedule.
  */
 
 #ifdef __arm__
@@ -40,6 +54,44 @@ void aesbs_xts_decrypt(u8 out[], u8 const in[], u8 const rk[], int rounds,
 		       int blocks, u8 iv[]);
 #endif
 
+#ifdef __x86_64__
+void aes_ni_encrypt(const u32 *rk, int rounds, const u8 *in, u8 *out);
+void aes_ni_decrypt(const u32 *rk, int rounds, const u8 *in, u8 *out);
+void aes_ni_xts_encrypt(const u32 *rk, int rounds, u8 *dst, const u8 *src,
+			unsigned int nbytes, u8 tweak[16]);
+void aes_ni_xts_decrypt(const u32 *rk, int rounds, u8 *dst, const u8 *src,
+			unsigned int nbytes, u8 tweak[16]);
+void aes_vaes_xts_encrypt(const u32 *rk, int rounds, u8 *dst, const u8 *src,
+			  unsigned int nbytes, u8 tweak[16]);
+void aes_vaes_xts_decrypt(const u32 *rk, int rounds, u8 *dst, const u8 *src,
+			  unsigned int nbytes, u8 tweak[16]);
+
+bool aes_aesni_usable(void)
+{
+	return cpu_have_features(X86_FEATURE_AES);
+}
+
+static inline bool have_vaes(void)
+{
+	return cpu_have_features(X86_FEATURE_AES | X86_FEATURE_AVX2 |
+				 X86_FEATURE_VAES | X86_FEATURE_VPCLMULQDQ);
+}
+#endif /* __x86_64__ */
+
+#ifdef __aarch64__
+void aes_ce_encrypt(const u32 *rk, int rounds, const u8 *in, u8 *out);
+void aes_ce_decrypt(const u32 *rk, int rounds, const u8 *in, u8 *out);
+void aes_ce_xts_encrypt(const u32 *rk, int rounds, u8 *dst, const u8 *src,
+			unsigned int nbytes, u8 tweak[16]);
+void aes_ce_xts_decrypt(const u32 *rk, int rounds, u8 *dst, const u8 *src,
+			unsigned int nbytes, u8 tweak[16]);
+
+bool aes_ce_usable(void)
+{
+	return cpu_have_features(ARM64_FEATURE_AES);
+}
+#endif /* __aarch64__ */
+
 static void aes_setkey(struct aes_ctx *ctx, const u8 *key, int key_len)
 {
 	int err;
@@ -53,6 +105,10 @@ static void aes_setkey(struct aes_ctx *ctx, const u8 *key, int key_len)
 	err = aesti_set_key(&ctx->aes_ctx, key, key_len);
 	ASSERT(err == 0);
 #endif
+#if defined(__x86_64__) || defined(__aarch64__)
+	err = aesti_expand_key(&ctx->aes_hw, key, key_len);
+	ASSERT(err == 0);
+#endif
 }
 
 void aes128_setkey(struct aes_ctx *ctx, const u8 *key)
@@ -65,7 +121,7 @@ void aes256_setkey(struct aes_ctx *ctx, const u8 *key)
 	aes_setkey(ctx, key, AES_KEYSIZE_256);
 }
 
-void aes_encrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+void aes_encrypt_generic(const struct aes_ctx *ctx, u8 *out, const u8 *in)
 {
 #ifdef __arm__
 	__aes_arm_encrypt(ctx->aes_ctx.key_enc, aes_nrounds(&ctx->aes_ctx),
@@ -75,7 +131,7 @@ void aes_encrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in)
 #endif
 }
 
-void aes_decrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+void aes_decrypt_generic(const struct aes_ctx *ctx, u8 *out, const u8 *in)
 {
 #ifdef __arm__
 	__aes_arm_decrypt(ctx->aes_ctx.key_dec, aes_nrounds(&ctx->aes_ctx),
@@ -85,6 +141,62 @@ void aes_decrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in)
 #endif
 }
 
+#ifdef __x86_64__
+void aes_encrypt_aesni(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+{
+	aes_ni_encrypt(ctx->aes_hw.key_enc, aes_nrounds(&ctx->aes_hw), in, out);
+}
+
+void aes_decrypt_aesni(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+{
+	aes_ni_decrypt(ctx->aes_hw.key_dec, aes_nrounds(&ctx->aes_hw), in, out);
+}
+#endif /* __x86_64__ */
+
+#ifdef __aarch64__
+void aes_encrypt_ce(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+{
+	aes_ce_encrypt(ctx->aes_hw.key_enc, aes_nrounds(&ctx->aes_hw), in, out);
+}
+
+void aes_decrypt_ce(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+{
+	aes_ce_decrypt(ctx->aes_hw.key_dec, aes_nrounds(&ctx->aes_hw), in, out);
+}
+#endif /* __aarch64__ */
+
+void aes_encrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+{
+#if defined(__x86_64__)
+	if (aes_aesni_usable()) {
+		aes_encrypt_aesni(ctx, out, in);
+		return;
+	}
+#elif defined(__aarch64__)
+	if (aes_ce_usable()) {
+		aes_encrypt_ce(ctx, out, in);
+		return;
+	}
+#endif
+	aes_encrypt_generic(ctx, out, in);
+}
+
+void aes_decrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in)
+{
+#if defined(__x86_64__)
+	if (aes_aesni_usable()) {
+		aes_decrypt_aesni(ctx, out, in);
+		return;
+	}
+#elif defined(__aarch64__)
+	if (aes_ce_usable()) {
+		aes_decrypt_ce(ctx, out, in);
+		return;
+	}
+#endif
+	aes_decrypt_generic(ctx, out, in);
+}
+
 #ifdef __arm__
 static void aes_xts_encrypt_neon(const struct aes_ctx *ctx,
 				 u8 *out, const u8 *in,
@@ -103,6 +215,88 @@ static void aes_xts_decrypt_neon(const struct aes_ctx *ctx,
 }
 #endif /* __arm__ */
 
+#ifdef __x86_64__
+static void aes_xts_encrypt_x86(const struct aes_ctx *ctx,
+				u8 *out, const u8 *in,
+				unsigned int nbytes, void *tweak)
+{
+	const int rounds = aes_nrounds(&ctx->aes_hw);
+
+	if (have_vaes() && nbytes >= 128) {
+		unsigned int n = round_down(nbytes, 128);
+
+		aes_vaes_xts_encrypt(ctx->aes_hw.key_enc, rounds, out, in, n,
+				     tweak);
+		out += n;
+		in += n;
+		nbytes -= n;
+	}
+	if (nbytes)
+		aes_ni_xts_encrypt(ctx->aes_hw.key_enc, rounds, out, in, nbytes,
+				   tweak);
+}
+
+static void aes_xts_decrypt_x86(const struct aes_ctx *ctx,
+				u8 *out, const u8 *in,
+				unsigned int nbytes, void *tweak)
+{
+	const int rounds = aes_nrounds(&ctx->aes_hw);
+
+	if (have_vaes() && nbytes >= 128) {
+		unsigned int n = round_down(nbytes, 128);
+
+		aes_vaes_xts_decrypt(ctx->aes_hw.key_dec, rounds, out, in, n,
+				     tweak);
+		out += n;
+		in += n;
+		nbytes -= n;
+	}
+	if (nbytes)
+		aes_ni_xts_decrypt(ctx->aes_hw.key_dec, rounds, out, in, nbytes,
+				   tweak);
+}
+
+static const char *aes_xts_impl_name_x86(void)
+{
+	return have_vaes() ? "VAES" : "AES-NI";
+}
+
+/* The 4-block AES-NI code alone, for comparison with VAES */
+static void aes_xts_encrypt_aesni(const struct aes_ctx *ctx,
+				  u8 *out, const u8 *in,
+				  unsigned int nbytes, void *tweak)
+{
+	aes_ni_xts_encrypt(ctx->aes_hw.key_enc, aes_nrounds(&ctx->aes_hw),
+			   out, in, nbytes, tweak);
+}
+
+static void aes_xts_decrypt_aesni(const struct aes_ctx *ctx,
+				  u8 *out, const u8 *in,
+				  unsigned int nbytes, void *tweak)
+{
+	aes_ni_xts_decrypt(ctx->aes_hw.key_dec, aes_nrounds(&ctx->aes_hw),
+			   out, in, nbytes, tweak);
+}
+#endif /* __x86_64__ */
+
+#ifdef __aarch64__
+static void aes_xts_encrypt_ce(const struct aes_ctx *ctx,
+			       u8 *out, const u8 *in,
+			       unsigned int nbytes, void *tweak)
+{
+	aes_ce_xts_encrypt(ctx->aes_hw.key_enc, aes_nrounds(&ctx->aes_hw),
+			   out, in, nbytes, tweak);
+}
+
+static void aes_xts_decrypt_ce(const struct aes_ctx *ctx,
+			       u8 *out, const u8 *in,
+			       unsigned int nbytes, void *tweak)
+{
+	aes_ce_xts_decrypt(ctx->aes_hw.key_dec, aes_nrounds(&ctx->aes_hw),
+			   out, in, nbytes, tweak);
+}
+#endif /* __aarch64__ */
+
 void test_aes(void)
 {
 	static const u8 tv128_key[16] =
@@ -146,11 +340,26 @@ void test_aes(void)
 #define KEY_BYTES	16
 #define KEY		struct aes_ctx
 #define SETKEY		aes128_setkey
-#define ENCRYPT		aes_encrypt
-#define DECRYPT		aes_decrypt
+#define ENCRYPT		aes_encrypt_generic
+#define DECRYPT		aes_decrypt_generic
+#define XTS_ENCRYPT_TWEAK aes_encrypt
 #ifdef __arm__
 #  define XTS_ENCRYPT_SIMD aes_xts_encrypt_neon
 #  define XTS_DECRYPT_SIMD aes_xts_decrypt_neon
+#elif defined(__x86_64__)
+#  define XTS_ENCRYPT_SIMD aes_xts_encrypt_x86
+#  define XTS_DECRYPT_SIMD aes_xts_decrypt_x86
+#  define XTS_SIMD_USABLE aes_aesni_usable()
+#  define XTS_SIMD_IMPL_NAME aes_xts_impl_name_x86()
+#  define XTS_ENCRYPT_SIMD_ALT aes_xts_encrypt_aesni
+#  define XTS_DECRYPT_SIMD_ALT aes_xts_decrypt_aesni
+#  define XTS_SIMD_ALT_USABLE have_vaes()
+#  define XTS_SIMD_ALT_IMPL_NAME "AES-NI"
+#elif defined(__aarch64__)
+#  define XTS_ENCRYPT_SIMD aes_xts_encrypt_ce
+#  define XTS_DECRYPT_SIMD aes_xts_decrypt_ce
+#  define XTS_SIMD_USABLE aes_ce_usable()
+#  define XTS_SIMD_IMPL_NAME "ARMv8-CE"
 #endif
 #include "xts_benchmark_template.h"
 
@@ -159,11 +368,26 @@ void test_aes(void)
 #define KEY_BYTES	32
 #define KEY		struct aes_ctx
 #define SETKEY		aes256_setkey
-#define ENCRYPT		aes_encrypt
-#define DECRYPT		aes_decrypt
+#define ENCRYPT		aes_encrypt_generic
+#define DECRYPT		aes_decrypt_generic
+#define XTS_ENCRYPT_TWEAK aes_encrypt
 #ifdef __arm__
 #  define XTS_ENCRYPT_SIMD aes_xts_encrypt_neon
 #  define XTS_DECRYPT_SIMD aes_xts_decrypt_neon
+#elif defined(__x86_64__)
+#  define XTS_ENCRYPT_SIMD aes_xts_encrypt_x86
+#  define XTS_DECRYPT_SIMD aes_xts_decrypt_x86
+#  define XTS_SIMD_USABLE aes_aesni_usable()
+#  define XTS_SIMD_IMPL_NAME aes_xts_impl_name_x86()
+#  define XTS_ENCRYPT_SIMD_ALT aes_xts_encrypt_aesni
+#  define XTS_DECRYPT_SIMD_ALT aes_xts_decrypt_aesni
+#  define XTS_SIMD_ALT_USABLE have_vaes()
+#  define XTS_SIMD_ALT_IMPL_NAME "AES-NI"
+#elif defined(__aarch64__)
+#  define XTS_ENCRYPT_SIMD aes_xts_encrypt_ce
+#  define XTS_DECRYPT_SIMD aes_xts_decrypt_ce
+#  define XTS_SIMD_USABLE aes_ce_usable()
+#  define XTS_SIMD_IMPL_NAME "ARMv8-CE"
 #endif
 #include "xts_benchmark_template.h"
 }
@@ -15,6 +15,10 @@ struct aes_ctx {
 	int rounds;
 	u8 pad[12];
 	u8 rk[13 * (8 * AES_BLOCK_SIZE) + 32];
+#endif
+#if defined(__x86_64__) || defined(__aarch64__)
+	/* for the AES instructions: the untweaked key schedule */
+	struct crypto_aes_ctx aes_hw;
 #endif
 	struct crypto_aes_ctx aes_ctx;
 } __attribute__((aligned(32)));
@@ -23,3 +27,20 @@ void aes128_setkey(struct aes_ctx *ctx, const u8 *key);
 void aes256_setkey(struct aes_ctx *ctx, const u8 *key);
 void aes_encrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in);
 void aes_decrypt(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+
+/*
+ * The individual single-block implementations, for comparing them.
+ * aes_encrypt() and aes_decrypt() use the fastest one that the CPU supports.
+ */
+void aes_encrypt_generic(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+void aes_decrypt_generic(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+#ifdef __x86_64__
+bool aes_aesni_usable(void);
+void aes_encrypt_aesni(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+void aes_decrypt_aesni(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+#endif
+#ifdef __aarch64__
+bool aes_ce_usable(void);
+void aes_encrypt_ce(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+void aes_decrypt_ce(const struct aes_ctx *ctx, u8 *out, const u8 *in);
+#endif
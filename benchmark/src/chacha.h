@@ -26,11 +26,39 @@ struct chacha_ctx {
 
 void chacha_setkey(struct chacha_ctx *ctx, const u8 *key, int nrounds);
 
+/*
+ * On ARM32, choose the fastest ChaCha implementation for the current --bufsize
+ * on each type of CPU core, by microbenchmarking them on a core of each type,
+ * and print the choices.  Call this before benchmarking each --bufsize;
+ * without a choice for it, ChaCha uses the default implementation.
+ */
+void chacha_autotune(void);
+
 void chacha(const struct chacha_ctx *ctx, u8 *dst, const u8 *src,
 	    unsigned int bytes, const u8 *iv, bool simd);
 void xchacha(const struct chacha_ctx *ctx, u8 *dst, const u8 *src,
 	     unsigned int nbytes, const u8 *iv, bool simd);
 
+/*
+ * The first part of xchacha(): derive the subkey from the key and the first 128
+ * nonce bits using HChaCha, and build the IV for chacha() with the subkey.
+ */
+void xchacha_subkey(const struct chacha_ctx *ctx, struct chacha_ctx *subctx,
+		    u8 real_iv[CHACHA_IV_SIZE], const u8 *iv, bool simd);
+
+/* Maximum number of streams that xchacha_multi() takes at once */
+#define CHACHA_MAX_LANES	16
+
+/*
+ * XChaCha on @nlanes independent messages of the same length, with the same key
+ * but different IVs, e.g. the sectors of one bio.  With SIMD this computes the
+ * streams in parallel with one stream per SIMD lane, which makes good use of the
+ * vector width even when each message is only a few blocks long.
+ */
+void xchacha_multi(const struct chacha_ctx *ctx, u8 * const dst[],
+		   const u8 * const src[], unsigned int nbytes,
+		   const u8 * const iv[], unsigned int nlanes, bool simd);
+
 void chacha_init_state(u32 state[16], const struct chacha_ctx *ctx,
 		       const u8 *iv);
 void chacha_perm_generic(u32 x[16], int nrounds);
@@ -41,8 +69,7 @@ void chacha_perm_neon(u32 state[16], int nrounds);
 #undef HAVE_CHACHA_SIMD
 #undef HAVE_HCHACHA_SIMD
 
-#if defined(__arm__) || defined(__aarch64__) || \
-	(defined(__x86_64__) && defined(__SSSE3__))
+#if defined(__arm__) || defined(__aarch64__) || defined(__x86_64__)
 #  define HAVE_CHACHA_SIMD 1
 #  define HAVE_HCHACHA_SIMD 1
 #endif
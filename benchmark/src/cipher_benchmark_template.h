@@ -5,6 +5,19 @@
  * license that can be found in the LICENSE file or at
  * https://opensource.org/licenses/MIT.
  */
+
+/* The implementation names to show, if not the default ones */
+#ifndef GENERIC_IMPL
+#  define GENERIC_IMPL	"generic"
+#endif
+#ifndef SIMD_IMPL
+#  define SIMD_IMPL	SIMD_IMPL_NAME
+#endif
+/* Whether the CPU can run the SIMD implementation, if not always */
+#ifndef SIMD_USABLE
+#  define SIMD_USABLE	true
+#endif
+
 {
 	const size_t bufsize = g_params.bufsize;
 	u8 *orig = calloc(1, bufsize);
@@ -18,11 +31,11 @@
 	u8 iv[IV_BYTES];
 	KEY ctx;
 	unsigned long i;
-	int try;
-	const int ntries = g_params.ntries;
 	const unsigned long nbytes = round_up(1000000, bufsize);
+	struct measurement m = { 0 };
+	struct latency_histogram *lat = NULL;
 	u64 start;
-	u64 best_time;
+	int w;
 
 	rand_bytes(key, sizeof(key));
 	rand_bytes(orig_iv, sizeof(iv));
@@ -30,53 +43,164 @@
 
 	SETKEY(&ctx, key);
 
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
+	measure_begin(&m);
+	while (measure_more(&m)) {
 		memcpy(iv, orig_iv, sizeof(iv));
-		start = now();
+		measure_start(&m);
 		for (i = 0; i < nbytes; i += bufsize)
 			ENCRYPT(&ctx, ctext, orig, bufsize, iv);
-		best_time = min(best_time, now() - start);
+		measure_stop(&m);
 	}
 	ASSERT(memcmp(orig, ctext, bufsize));
-	show_result(ALGNAME, "encryption", "generic", nbytes, best_time);
+	show_measurement(ALGNAME, "encryption", GENERIC_IMPL, nbytes, &m);
 
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
+	measure_begin(&m);
+	while (measure_more(&m)) {
 		memcpy(iv, orig_iv, sizeof(iv));
-		start = now();
+		measure_start(&m);
 		for (i = 0; i < nbytes; i += bufsize)
 			DECRYPT(&ctx, ptext, ctext, bufsize, iv);
-		best_time = min(best_time, now() - start);
+		measure_stop(&m);
 	}
 	ASSERT(!memcmp(orig, ptext, bufsize));
-	show_result(ALGNAME, "decryption", "generic", nbytes, best_time);
+	show_measurement(ALGNAME, "decryption", GENERIC_IMPL, nbytes, &m);
 
 #ifdef ENCRYPT_SIMD
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		memcpy(iv, orig_iv, sizeof(iv));
-		start = now();
-		for (i = 0; i < nbytes; i += bufsize)
-			ENCRYPT_SIMD(&ctx, ctext_simd, orig, bufsize, iv);
-		best_time = min(best_time, now() - start);
-		ASSERT(memcmp(orig, ctext_simd, bufsize));
-		ASSERT(!memcmp(ctext, ctext_simd, bufsize));
+	if (SIMD_USABLE) {
+		measure_begin(&m);
+		while (measure_more(&m)) {
+			memcpy(iv, orig_iv, sizeof(iv));
+			measure_start(&m);
+			for (i = 0; i < nbytes; i += bufsize)
+				ENCRYPT_SIMD(&ctx, ctext_simd, orig, bufsize,
+					     iv);
+			measure_stop(&m);
+			ASSERT(memcmp(orig, ctext_simd, bufsize));
+			ASSERT(!memcmp(ctext, ctext_simd, bufsize));
+		}
+		show_measurement(ALGNAME, "encryption", SIMD_IMPL, nbytes, &m);
+		measure_begin(&m);
+		while (measure_more(&m)) {
+			memcpy(iv, orig_iv, sizeof(iv));
+			measure_start(&m);
+			for (i = 0; i < nbytes; i += bufsize)
+				DECRYPT_SIMD(&ctx, ptext, ctext_simd, bufsize,
+					     iv);
+			measure_stop(&m);
+			ASSERT(!memcmp(orig, ptext, bufsize));
+		}
+		show_measurement(ALGNAME, "decryption", SIMD_IMPL, nbytes, &m);
 	}
-	show_result(ALGNAME, "encryption", SIMD_IMPL_NAME, nbytes, best_time);
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		memcpy(iv, orig_iv, sizeof(iv));
-		start = now();
-		for (i = 0; i < nbytes; i += bufsize)
-			DECRYPT_SIMD(&ctx, ptext, ctext_simd, bufsize, iv);
-		best_time = min(best_time, now() - start);
+#endif /* ENCRYPT_SIMD */
+
+	/* The latency of single calls */
+	if (g_params.latency_calls) {
+		lat = malloc(sizeof(*lat));
+		latency_reset(lat);
+		for (i = 0; i < g_params.latency_calls; i++) {
+			memcpy(iv, orig_iv, sizeof(iv));
+			start = ticks();
+			ENCRYPT(&ctx, ctext, orig, bufsize, iv);
+			latency_record(lat, ticks() - start);
+		}
+		show_latency(ALGNAME, "encryption", GENERIC_IMPL, lat);
+		latency_reset(lat);
+		for (i = 0; i < g_params.latency_calls; i++) {
+			memcpy(iv, orig_iv, sizeof(iv));
+			start = ticks();
+			DECRYPT(&ctx, ptext, ctext, bufsize, iv);
+			latency_record(lat, ticks() - start);
+		}
+		show_latency(ALGNAME, "decryption", GENERIC_IMPL, lat);
+#ifdef ENCRYPT_SIMD
+		if (SIMD_USABLE) {
+			latency_reset(lat);
+			for (i = 0; i < g_params.latency_calls; i++) {
+				memcpy(iv, orig_iv, sizeof(iv));
+				start = ticks();
+				ENCRYPT_SIMD(&ctx, ctext_simd, orig, bufsize,
+					     iv);
+				latency_record(lat, ticks() - start);
+			}
+			show_latency(ALGNAME, "encryption", SIMD_IMPL, lat);
+			latency_reset(lat);
+			for (i = 0; i < g_params.latency_calls; i++) {
+				memcpy(iv, orig_iv, sizeof(iv));
+				start = ticks();
+				DECRYPT_SIMD(&ctx, ptext, ctext_simd, bufsize,
+					     iv);
+				latency_record(lat, ticks() - start);
+			}
+			show_latency(ALGNAME, "decryption", SIMD_IMPL, lat);
+		}
+#endif
 		ASSERT(!memcmp(orig, ptext, bufsize));
 	}
-	show_result(ALGNAME, "decryption", SIMD_IMPL_NAME, nbytes, best_time);
-#endif /* ENCRYPT_SIMD */
+
+	/*
+	 * Encryption of consecutive messages in source and destination buffers
+	 * that together are the size of each working set
+	 */
+	for (w = 0; w < g_params.num_working_sets; w++) {
+		const size_t nmsgs = max(g_params.working_sets[w].size / 2 /
+					 bufsize, (size_t)1);
+		const unsigned long ws_nbytes = max(nbytes, nmsgs * bufsize);
+		u8 *ws_src = malloc(nmsgs * bufsize);
+		u8 *ws_dst = malloc(nmsgs * bufsize);
+		char label[64];
+		char impl_name[128];
+		size_t k;
+
+		ASSERT(ws_src != NULL && ws_dst != NULL);
+		memset(ws_src, 0x5a, nmsgs * bufsize);
+		memset(ws_dst, 0, nmsgs * bufsize);
+		working_set_label(&g_params.working_sets[w], label,
+				  sizeof(label));
+
+		measure_begin(&m);
+		while (measure_more(&m)) {
+			memcpy(iv, orig_iv, sizeof(iv));
+			measure_start(&m);
+			for (i = 0, k = 0; i < ws_nbytes; i += bufsize) {
+				ENCRYPT(&ctx, &ws_dst[k * bufsize],
+					&ws_src[k * bufsize], bufsize, iv);
+				if (++k == nmsgs)
+					k = 0;
+			}
+			measure_stop(&m);
+		}
+		sprintf(impl_name, "%s, %s", GENERIC_IMPL, label);
+		show_measurement(ALGNAME, "encryption", impl_name, ws_nbytes,
+				 &m);
+#ifdef ENCRYPT_SIMD
+		if (SIMD_USABLE) {
+			measure_begin(&m);
+			while (measure_more(&m)) {
+				memcpy(iv, orig_iv, sizeof(iv));
+				measure_start(&m);
+				for (i = 0, k = 0; i < ws_nbytes;
+				     i += bufsize) {
+					ENCRYPT_SIMD(&ctx,
+						     &ws_dst[k * bufsize],
+						     &ws_src[k * bufsize],
+						     bufsize, iv);
+					if (++k == nmsgs)
+						k = 0;
+				}
+				measure_stop(&m);
+			}
+			sprintf(impl_name, "%s, %s", SIMD_IMPL, label);
+			show_measurement(ALGNAME, "encryption", impl_name,
+					 ws_nbytes, &m);
+		}
+#endif
+		free(ws_src);
+		free(ws_dst);
+	}
 	putchar('\n');
 
+	measure_free(&m);
+	free(lat);
 	free(orig);
 	free(ctext);
 #ifdef ENCRYPT_SIMD
@@ -86,6 +210,9 @@
 }
 
 #undef ALGNAME
+#undef GENERIC_IMPL
+#undef SIMD_IMPL
+#undef SIMD_USABLE
 #undef KEY_BYTES
 #undef IV_BYTES
 #undef KEY
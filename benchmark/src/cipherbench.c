@@ -8,6 +8,11 @@
  * https://opensource.org/licenses/MIT.
  */
 
+#include "cbconfig.h"
+
+#include "chacha.h"
+#include "cpufeatures.h"
+#include "hbsh.h"
 #include "util.h"
 
 #include <errno.h>
@@ -28,6 +33,7 @@ static const struct cipher {
 	{ "HPolyC",		test_hpolyc },
 	{ "LEA",		test_lea },
 	{ "NH",			test_nh },
+	{ "NHPoly1305",		test_nhpoly1305 },
 	{ "NOEKEON",		test_noekeon },
 	{ "Poly1305",		test_poly1305 },
 	{ "RC5",		test_rc5 },
@@ -47,7 +53,7 @@ static const struct cipher *find_cipher(const char *name)
 	return NULL;
 }
 
-static int get_num_cpus(void)
+int get_num_cpus(void)
 {
 	static int ncpus;
 
@@ -63,6 +69,139 @@ static int get_num_cpus(void)
 
 static char saved_cpufreq_governor[65];
 
+/* Read the first line of cache/index@index/@name of CPU 0 */
+static bool read_cache_attr(int index, const char *name, char *buf, int size)
+{
+	char path[128];
+	FILE *f;
+	bool ok;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/%s",
+		index, name);
+	f = fopen(path, "r");
+	if (!f)
+		return false;
+	ok = fgets(buf, size, f) != NULL;
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return ok;
+}
+
+/* The size of the data or unified cache at @level, or 0 if unknown */
+static size_t get_cache_size(int level)
+{
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		char buf[32];
+		char unit = 0;
+		unsigned long n;
+
+		if (!read_cache_attr(i, "level", buf, sizeof(buf)))
+			break;
+		if (atoi(buf) != level)
+			continue;
+		if (!read_cache_attr(i, "type", buf, sizeof(buf)) ||
+		    !strcmp(buf, "Instruction"))
+			continue;
+		if (!read_cache_attr(i, "size", buf, sizeof(buf)) ||
+		    sscanf(buf, "%lu%c", &n, &unit) < 1)
+			continue;
+		if (unit == 'K')
+			n <<= 10;
+		else if (unit == 'M')
+			n <<= 20;
+		size = max(size, (size_t)n);
+	}
+	return size;
+}
+
+/*
+ * The default --cold-keys: enough keys for their contexts to take twice the
+ * size of the last level cache (at most 1 GiB), so that each key has been
+ * evicted from all the caches by the time it's used again, but at least 4096.
+ */
+static int default_cold_keys(void)
+{
+	size_t llc = 0;
+	size_t bytes;
+	int level;
+
+	for (level = 3; level >= 1 && llc == 0; level--)
+		llc = get_cache_size(level);
+	bytes = min(2 * llc, (size_t)1 << 30);
+	return max(DIV_ROUND_UP(bytes, sizeof(struct hbsh_ctx)), (size_t)4096);
+}
+
+/*
+ * Use working sets that fit in half of each level of cache, then one 4 times
+ * the size of the last level cache (at least 64 MiB, at most 1 GiB) for DRAM.
+ */
+static void add_default_working_sets(void)
+{
+	static const char * const names[] = { "L1", "L2", "L3" };
+	size_t llc = 0;
+	int level;
+
+	for (level = 1; level <= ARRAY_SIZE(names); level++) {
+		size_t size = get_cache_size(level);
+
+		if (size == 0)
+			continue;
+		g_params.working_sets[g_params.num_working_sets++] =
+			(struct working_set){ names[level - 1], size / 2 };
+		llc = size;
+	}
+	if (llc == 0)
+		fprintf(stderr, "Unable to find the CPU cache sizes\n");
+	g_params.working_sets[g_params.num_working_sets++] =
+		(struct working_set){ "DRAM",
+			min(max(4 * llc, (size_t)64 << 20), (size_t)1 << 30) };
+}
+
+/* Parse a comma-separated list of sizes with optional K or M suffixes */
+static bool parse_working_sets(const char *arg)
+{
+	char *end;
+
+	do {
+		size_t size = strtoul(arg, &end, 10);
+
+		if (*end == 'K' || *end == 'k')
+			size <<= 10, end++;
+		else if (*end == 'M' || *end == 'm')
+			size <<= 20, end++;
+		if (size == 0 || (*end && *end != ',') ||
+		    g_params.num_working_sets == MAX_WORKING_SETS)
+			return false;
+		g_params.working_sets[g_params.num_working_sets++] =
+			(struct working_set){ NULL, size };
+		arg = end + 1;
+	} while (*end);
+	return true;
+}
+
+void working_set_label(const struct working_set *ws, char *buf, size_t size)
+{
+	const char *unit = "bytes";
+	size_t n = ws->size;
+
+	if (n >= 10240) {
+		unit = "KiB";
+		n >>= 10;
+	}
+	if (n >= 10240) {
+		unit = "MiB";
+		n >>= 10;
+	}
+	if (ws->name)
+		snprintf(buf, size, "%s-sized working set, %zu %s", ws->name,
+			 n, unit);
+	else
+		snprintf(buf, size, "%zu %s working set", n, unit);
+}
+
 static void set_cpufreq_governor(const char *governor)
 {
 	int cpu, ncpus = get_num_cpus();
@@ -184,17 +323,596 @@ static void deconfigure_cpu(void)
 		set_cpufreq_governor(saved_cpufreq_governor);
 }
 
+/* Machine-readable results go here; other output is moved to stderr */
+static FILE *results_file;
+static int num_results;
+
+static void print_json_string(FILE *f, const char *str)
+{
+	putc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(f, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			putc(*str, f);
+	}
+	putc('"', f);
+}
+
+static void print_csv_string(FILE *f, const char *str)
+{
+	putc('"', f);
+	for (; *str; str++) {
+		if (*str == '"')
+			putc('"', f);
+		putc(*str, f);
+	}
+	putc('"', f);
+}
+
+static char cpu_model[128] = "unknown";
+
+/* Get a description of the CPU from /proc/cpuinfo, if available */
+static void get_cpu_model(void)
+{
+	static const char * const keys[] = {
+		"model name", "Hardware", "Processor", "CPU part",
+	};
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	char line[256];
+	int best = ARRAY_SIZE(keys);
+	int i;
+
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		char *value = strchr(line, ':');
+
+		if (!value)
+			continue;
+		for (i = 0; i < best; i++) {
+			if (!strncmp(line, keys[i], strlen(keys[i])))
+				break;
+		}
+		if (i == best)
+			continue;
+		value += strspn(value + 1, " \t") + 1;
+		value[strcspn(value, "\n")] = '\0';
+		if (*value) {
+			snprintf(cpu_model, sizeof(cpu_model), "%s", value);
+			best = i;
+		}
+	}
+	fclose(f);
+}
+
+/* Everything that's the same for all results */
+static void begin_results(void)
+{
+	if (g_params.format == FORMAT_JSON) {
+		fprintf(results_file, "{\n  \"cpu_model\": ");
+		print_json_string(results_file, cpu_model);
+		fprintf(results_file, ",\n  \"cpu_frequency_kHz\": ");
+		if (cpu_frequency_kHz)
+			fprintf(results_file, "%"PRIu64, cpu_frequency_kHz);
+		else
+			fprintf(results_file, "null");
+		fprintf(results_file, ",\n  \"cycle_source\": ");
+		if (measure_cycle_source())
+			print_json_string(results_file, measure_cycle_source());
+		else
+			fprintf(results_file, "null");
+		fprintf(results_file, ",\n  \"compile_flags\": ");
+		print_json_string(results_file, COMPILE_FLAGS);
+		fprintf(results_file, ",\n  \"compiler\": ");
+		print_json_string(results_file, __VERSION__);
+		fprintf(results_file, ",\n  \"results\": [");
+	} else if (g_params.format == FORMAT_CSV) {
+		fprintf(results_file,
+			"algorithm,operation,implementation,bufsize,bytes,"
+			"best_ns,median_ns,p5_ns,p95_ns,mean_ns,stddev_ns,"
+			"ci95_ns,samples,outliers,cycles,instructions,ipc,"
+			"branch_misses,l1d_misses,cpb,KB_per_s,calls,p50_ns,"
+			"p99_ns,p999_ns,max_ns,item,ns_per_item,"
+			"efficiency_pct,delta_pct,baseline,"
+			"cpu_frequency_kHz,cycle_source,compile_flags,"
+			"cpu_model\n");
+	}
+}
+
+static void end_results(void)
+{
+	if (g_params.format == FORMAT_JSON)
+		fprintf(results_file, "%s]\n}\n", num_results ? "\n  " : "");
+	if (results_file)
+		fflush(results_file);
+}
+
+/* --bufsize-sweep: sizes from sweep_min to sweep_max, by + or * sweep_step */
+static int sweep_min, sweep_max;
+static double sweep_step;
+static bool sweep_geometric;
+
+/* The throughput results of a sweep, for the crossover report */
+static struct sweep_result {
+	char *algname;
+	char *op;
+	char *impl;
+	int bufsize;
+	double ns_per_byte;
+	double cpb;		/* 0 if unknown */
+} *sweep_results;
+static int num_sweep_results;
+
+static void record_sweep_result(const char *algname, const char *op,
+				const char *impl, int bufsize, u64 nbytes,
+				u64 best_ns, double cpb)
+{
+	struct sweep_result *res;
+
+	if (num_sweep_results % 64 == 0) {
+		sweep_results = realloc(sweep_results,
+					(num_sweep_results + 64) *
+					sizeof(sweep_results[0]));
+		ASSERT(sweep_results != NULL);
+	}
+	res = &sweep_results[num_sweep_results++];
+	res->algname = strdup(algname);
+	res->op = strdup(op);
+	res->impl = strdup(impl);
+	ASSERT(res->algname && res->op && res->impl);
+	res->bufsize = bufsize;
+	res->ns_per_byte = (double)best_ns / nbytes;
+	res->cpb = cpb;
+}
+
+/*
+ * Print a field of a result: ', "name": value' for JSON or ',value' for CSV.
+ * If !known, the value is null or empty.
+ */
+static void print_field(FILE *f, const char *name, const char *fmt, double v,
+			bool known)
+{
+	if (g_params.format == FORMAT_JSON)
+		fprintf(f, ", \"%s\": ", name);
+	else
+		putc(',', f);
+	if (known)
+		fprintf(f, fmt, v);
+	else if (g_params.format == FORMAT_JSON)
+		fprintf(f, "null");
+}
+
+/* Like print_field(), but for a string, or null or empty if @s is NULL */
+static void print_string_field(FILE *f, const char *name, const char *s)
+{
+	if (g_params.format == FORMAT_JSON)
+		fprintf(f, ", \"%s\": ", name);
+	else
+		putc(',', f);
+	if (!s) {
+		if (g_params.format == FORMAT_JSON)
+			fprintf(f, "null");
+	} else if (g_params.format == FORMAT_JSON) {
+		print_json_string(f, s);
+	} else {
+		print_csv_string(f, s);
+	}
+}
+
+/* Show the derived figures @x on a line under the result */
+static void show_result_extra_text(const struct result_extra *x)
+{
+	if (x->item) {
+		printf("%-45s %.1f ns", "", x->ns_per_item);
+		if (cpu_frequency_kHz)
+			printf(" (%.0f cycles)",
+			       x->ns_per_item * cpu_frequency_kHz / 1e6);
+		printf(" per %s", x->item);
+		if (!isnan(x->delta_pct))
+			printf(", %+.1f%% vs. %s", x->delta_pct, x->baseline);
+		putchar('\n');
+	} else if (!isnan(x->delta_pct)) {
+		printf("%-45s %+.1f%% vs. %s\n", "", x->delta_pct, x->baseline);
+	}
+	if (!isnan(x->efficiency_pct))
+		printf("%-45s %5.1f%% per-thread efficiency\n", "",
+		       x->efficiency_pct);
+}
+
+/*
+ * Report the throughput @s of processing @nbytes, the latencies @l of calls
+ * that each process g_params.bufsize bytes, or both, and the derived figures
+ * @x if not NULL.  @msglen is the size of the messages if it isn't
+ * g_params.bufsize, or 0 if it is; only the results that follow
+ * g_params.bufsize go in the --bufsize-sweep report.
+ */
+static void report_result(const char *algname, const char *op,
+			  const char *impl, int msglen, u64 nbytes,
+			  const struct measurement_stats *s,
+			  const struct latency_stats *l,
+			  const struct result_extra *x)
+{
+	static const struct measurement_stats no_stats;
+	static const struct latency_stats no_latency;
+	static const struct result_extra no_extra = RESULT_EXTRA_INIT;
+	FILE *f = results_file;
+	const bool csv = (g_params.format == FORMAT_CSV);
+	const bool have_time = (s != NULL);
+	const bool have_stats = have_time && s->nsamples != 0;
+	const bool have_latency = (l != NULL);
+	const u64 *counts;
+	bool have_ipc;
+	double cpb;
+
+	if (!s)
+		s = &no_stats;
+	if (!l)
+		l = &no_latency;
+	if (!x)
+		x = &no_extra;
+	counts = s->counts;
+	have_ipc = counts[COUNTER_CYCLES] != 0 &&
+		   counts[COUNTER_INSTRUCTIONS] != 0;
+	cpb = have_time ? cycles_per_byte(nbytes, s->best_ns) : 0;
+
+	/* Prefer counted cycles to ones derived from the time */
+	if (counts[COUNTER_CYCLES] != 0)
+		cpb = (double)counts[COUNTER_CYCLES] / nbytes;
+
+	if (sweep_max && have_time && msglen == 0)
+		record_sweep_result(algname, op, impl, g_params.bufsize,
+				    nbytes, s->best_ns,
+				    counts[COUNTER_CYCLES] != 0 ||
+				    cpu_frequency_kHz != 0 ? cpb : 0);
+	if (msglen == 0)
+		msglen = g_params.bufsize;
+
+	if (g_params.format != FORMAT_TEXT) {
+		if (g_params.format == FORMAT_JSON) {
+			fprintf(f, "%s\n    { \"algorithm\": ",
+				num_results ? "," : "");
+			print_json_string(f, algname);
+			fprintf(f, ", \"operation\": ");
+			print_json_string(f, op);
+			fprintf(f, ", \"implementation\": ");
+			print_json_string(f, impl);
+		} else {
+			print_csv_string(f, algname);
+			putc(',', f);
+			print_csv_string(f, op);
+			putc(',', f);
+			print_csv_string(f, impl);
+		}
+		print_field(f, "bufsize", "%.0f", msglen, true);
+		/* JSON only has the fields for the kind of result */
+		if (have_time || csv) {
+			print_field(f, "bytes", "%.0f", nbytes, have_time);
+			print_field(f, "best_ns", "%.0f", s->best_ns, have_time);
+			print_field(f, "median_ns", "%.0f", s->median_ns,
+				    have_stats);
+			print_field(f, "p5_ns", "%.0f", s->p5_ns, have_stats);
+			print_field(f, "p95_ns", "%.0f", s->p95_ns, have_stats);
+			print_field(f, "mean_ns", "%.1f", s->mean_ns,
+				    have_stats);
+			print_field(f, "stddev_ns", "%.1f", s->stddev_ns,
+				    have_stats);
+			print_field(f, "ci95_ns", "%.1f", s->ci_ns, have_stats);
+			print_field(f, "samples", "%.0f", s->nsamples,
+				    have_stats);
+			print_field(f, "outliers", "%.0f", s->noutliers,
+				    have_stats);
+			print_field(f, "cycles", "%.0f", counts[COUNTER_CYCLES],
+				    counts[COUNTER_CYCLES] != 0);
+			print_field(f, "instructions", "%.0f",
+				    counts[COUNTER_INSTRUCTIONS],
+				    counts[COUNTER_INSTRUCTIONS] != 0);
+			print_field(f, "ipc", "%.3f",
+				    (double)counts[COUNTER_INSTRUCTIONS] /
+				    counts[COUNTER_CYCLES], have_ipc);
+			print_field(f, "branch_misses", "%.0f",
+				    counts[COUNTER_BRANCH_MISSES],
+				    have_ipc &&
+				    measure_have_counter(COUNTER_BRANCH_MISSES));
+			print_field(f, "l1d_misses", "%.0f",
+				    counts[COUNTER_L1D_MISSES],
+				    have_ipc &&
+				    measure_have_counter(COUNTER_L1D_MISSES));
+			print_field(f, "cpb", "%.3f", cpb,
+				    have_time && (counts[COUNTER_CYCLES] != 0 ||
+						  cpu_frequency_kHz != 0));
+			print_field(f, "KB_per_s", "%.0f",
+				    have_time ? KB_per_s(nbytes, s->best_ns) : 0,
+				    have_time);
+		}
+		if (have_latency || csv) {
+			print_field(f, "calls", "%.0f", l->ncalls, have_latency);
+			print_field(f, "p50_ns", "%.0f", l->p50_ns,
+				    have_latency);
+			print_field(f, "p99_ns", "%.0f", l->p99_ns,
+				    have_latency);
+			print_field(f, "p999_ns", "%.0f", l->p999_ns,
+				    have_latency);
+			print_field(f, "max_ns", "%.0f", l->max_ns,
+				    have_latency);
+		}
+		if (x->item || csv) {
+			print_string_field(f, "item", x->item);
+			print_field(f, "ns_per_item", "%.1f", x->ns_per_item,
+				    x->item != NULL);
+		}
+		if (!isnan(x->efficiency_pct) || csv)
+			print_field(f, "efficiency_pct", "%.1f",
+				    x->efficiency_pct,
+				    !isnan(x->efficiency_pct));
+		if (!isnan(x->delta_pct) || csv) {
+			print_field(f, "delta_pct", "%.1f", x->delta_pct,
+				    !isnan(x->delta_pct));
+			print_string_field(f, "baseline", x->baseline);
+		}
+		if (g_params.format == FORMAT_JSON) {
+			fprintf(f, " }");
+		} else {
+			print_field(f, "cpu_frequency_kHz", "%.0f",
+				    cpu_frequency_kHz, cpu_frequency_kHz != 0);
+			putc(',', f);
+			if (measure_cycle_source())
+				print_csv_string(f, measure_cycle_source());
+			putc(',', f);
+			print_csv_string(f, COMPILE_FLAGS);
+			putc(',', f);
+			print_csv_string(f, cpu_model);
+			putc('\n', f);
+		}
+	} else if (have_latency && !have_time) {
+		char hdr[strlen(algname) + strlen(op) + strlen(impl) + 20];
+
+		sprintf(hdr, "%s %s latency (%s) ", algname, op, impl);
+
+		printf("%-45s p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, "
+		       "max %.0f ns\n", hdr, l->p50_ns, l->p99_ns, l->p999_ns,
+		       l->max_ns);
+		f = stdout;
+	} else {
+		char hdr[strlen(algname) + strlen(op) + strlen(impl) + 10];
+		const char *sep = "  [";
+
+		sprintf(hdr, "%s %s (%s) ", algname, op, impl);
+
+		printf("%-45s %6.3f cpb (%" PRIu64 " KB/s)",
+		       hdr, cpb, KB_per_s(nbytes, s->best_ns));
+		if (have_ipc) {
+			printf("%sIPC %.2f", sep,
+			       (double)counts[COUNTER_INSTRUCTIONS] /
+			       counts[COUNTER_CYCLES]);
+			sep = ", ";
+		}
+		/* The spread of the runs, relative to the best one */
+		if (have_stats && s->nsamples > 1) {
+			printf("%smedian +%.1f%%, p95 +%.1f%%, sd %.1f%%, "
+			       "%d runs, %d outliers", sep,
+			       100.0 * (s->median_ns - s->best_ns) / s->best_ns,
+			       100.0 * (s->p95_ns - s->best_ns) / s->best_ns,
+			       100.0 * s->stddev_ns / s->mean_ns,
+			       s->nsamples, s->noutliers);
+			sep = ", ";
+		}
+		if (sep[0] == ',')
+			putchar(']');
+		putchar('\n');
+		/* The latencies of the requests that made up the run */
+		if (have_latency)
+			printf("%-45s latency p50 %.1f us, p99 %.1f us, "
+			       "p99.9 %.1f us, max %.1f us\n", "",
+			       l->p50_ns / 1000, l->p99_ns / 1000,
+			       l->p999_ns / 1000, l->max_ns / 1000);
+		show_result_extra_text(x);
+		f = stdout;
+	}
+	num_results++;
+	fflush(f);
+}
+
 void show_result(const char *algname, const char *op, const char *impl,
 		 u64 nbytes, u64 ns_elapsed)
 {
-	char hdr[strlen(algname) + strlen(op) + strlen(impl) + 10];
+	struct measurement_stats stats = { .best_ns = ns_elapsed };
+
+	report_result(algname, op, impl, 0, nbytes, &stats, NULL, NULL);
+}
+
+void show_measurement(const char *algname, const char *op, const char *impl,
+		      u64 nbytes, struct measurement *m)
+{
+	struct measurement_stats stats;
 
-	sprintf(hdr, "%s %s (%s) ", algname, op, impl);
+	measure_get_stats(m, &stats);
+	report_result(algname, op, impl, 0, nbytes, &stats, NULL, NULL);
+}
 
-	printf("%-45s %6.3f cpb (%" PRIu64 " KB/s)\n",
-	       hdr, cycles_per_byte(nbytes, ns_elapsed),
-	       KB_per_s(nbytes, ns_elapsed));
-	fflush(stdout);
+void show_measurement_msglen(const char *algname, const char *op,
+			     const char *impl, int msglen, u64 nbytes,
+			     struct measurement *m)
+{
+	struct measurement_stats stats;
+
+	measure_get_stats(m, &stats);
+	report_result(algname, op, impl, msglen, nbytes, &stats, NULL, NULL);
+}
+
+void show_latency(const char *algname, const char *op, const char *impl,
+		  const struct latency_histogram *h)
+{
+	struct latency_stats stats;
+
+	latency_get_stats(h, &stats);
+	report_result(algname, op, impl, 0, 0, NULL, &stats, NULL);
+}
+
+void show_result_extra(const char *algname, const char *op, const char *impl,
+		       int msglen, u64 nbytes,
+		       const struct measurement_stats *s,
+		       const struct latency_stats *l,
+		       const struct result_extra *x)
+{
+	report_result(algname, op, impl, msglen, nbytes, s, l, x);
+}
+
+static bool same_group(const struct sweep_result *a,
+		       const struct sweep_result *b)
+{
+	return !strcmp(a->algname, b->algname) && !strcmp(a->op, b->op);
+}
+
+static const struct sweep_result *
+find_sweep_result(const struct sweep_result *group, const char *impl,
+		  int bufsize)
+{
+	int i;
+
+	for (i = 0; i < num_sweep_results; i++) {
+		const struct sweep_result *res = &sweep_results[i];
+
+		if (same_group(res, group) && res->bufsize == bufsize &&
+		    !strcmp(res->impl, impl))
+			return res;
+	}
+	return NULL;
+}
+
+static double sweep_speed(const struct sweep_result *res, bool cpb)
+{
+	return cpb ? res->cpb : res->ns_per_byte;
+}
+
+/* Show which implementations became faster than which others at @size */
+static void show_overtakes(const struct sweep_result *group,
+			   const char * const impls[], int nimpls,
+			   int prev_size, int size)
+{
+	const struct sweep_result *prev_a, *prev_b, *cur_a, *cur_b;
+	int a, b;
+
+	for (a = 0; a < nimpls; a++) {
+		prev_a = find_sweep_result(group, impls[a], prev_size);
+		cur_a = find_sweep_result(group, impls[a], size);
+		for (b = 0; b < nimpls; b++) {
+			prev_b = find_sweep_result(group, impls[b], prev_size);
+			cur_b = find_sweep_result(group, impls[b], size);
+			if (!prev_a || !prev_b || !cur_a || !cur_b)
+				continue;
+			if (prev_a->ns_per_byte > prev_b->ns_per_byte &&
+			    cur_a->ns_per_byte < cur_b->ns_per_byte)
+				printf("  <- [%d] overtakes [%d]", a + 1, b + 1);
+		}
+	}
+}
+
+/*
+ * For each algorithm and operation, show the speed of each implementation at
+ * each message size, and mark the sizes at which one implementation overtakes
+ * another, i.e. becomes faster than it where it was slower at the previous
+ * size.
+ */
+static void show_sweep_report(void)
+{
+	const char *impls[32];
+	int sizes[256];
+	bool *done;
+	int i, j, k, a;
+
+	if (num_sweep_results == 0)
+		return;
+	done = calloc(num_sweep_results, sizeof(done[0]));
+	ASSERT(done != NULL);
+	for (i = 0; i < num_sweep_results; i++) {
+		const struct sweep_result *group = &sweep_results[i];
+		int nimpls = 0, nsizes = 0;
+		bool cpb = true;
+
+		if (done[i])
+			continue;
+		for (j = i; j < num_sweep_results; j++) {
+			const struct sweep_result *res = &sweep_results[j];
+
+			if (!same_group(res, group))
+				continue;
+			done[j] = true;
+			if (res->cpb == 0)
+				cpb = false;
+			for (k = 0; k < nimpls; k++)
+				if (!strcmp(impls[k], res->impl))
+					break;
+			if (k == nimpls && nimpls < ARRAY_SIZE(impls))
+				impls[nimpls++] = res->impl;
+			for (k = 0; k < nsizes; k++)
+				if (sizes[k] == res->bufsize)
+					break;
+			if (k == nsizes && nsizes < ARRAY_SIZE(sizes))
+				sizes[nsizes++] = res->bufsize;
+		}
+
+		printf("%s %s (%s):\n", group->algname, group->op,
+		       cpb ? "cpb" : "ns/byte");
+		for (a = 0; a < nimpls; a++)
+			printf("\t[%d] %s\n", a + 1, impls[a]);
+		printf("%8s", "bytes");
+		for (a = 0; a < nimpls; a++)
+			printf("%9s[%d]", "", a + 1);
+		printf("\n");
+		for (k = 0; k < nsizes; k++) {
+			printf("%8d", sizes[k]);
+			for (a = 0; a < nimpls; a++) {
+				const struct sweep_result *res =
+					find_sweep_result(group, impls[a],
+							  sizes[k]);
+				if (res)
+					printf("  %10.3f",
+					       sweep_speed(res, cpb));
+				else
+					printf("  %10s", "-");
+			}
+			if (k > 0)
+				show_overtakes(group, impls, nimpls,
+					       sizes[k - 1], sizes[k]);
+			printf("\n");
+		}
+		printf("\n");
+	}
+	free(done);
+}
+
+/* Parse MIN:MAX:STEP, where STEP is +N (the default) or xN */
+static bool parse_sweep(const char *arg)
+{
+	char step_type = '+';
+	char *end;
+
+	sweep_min = strtol(arg, &end, 10);
+	if (*end != ':')
+		return false;
+	sweep_max = strtol(end + 1, &end, 10);
+	if (*end != ':')
+		return false;
+	end++;
+	if (*end == '+' || *end == 'x' || *end == '*')
+		step_type = *end++;
+	sweep_step = strtod(end, &end);
+	if (*end)
+		return false;
+	sweep_geometric = (step_type != '+');
+	return sweep_min > 0 && sweep_max >= sweep_min &&
+		(sweep_geometric ? sweep_step > 1 : sweep_step >= 1);
+}
+
+/* The next size of the sweep, rounded up to a multiple of 16 bytes */
+static int next_sweep_size(int size)
+{
+	double next = sweep_geometric ? size * sweep_step : size + sweep_step;
+
+	return max(round_up((int)next, 16), size + 16);
 }
 
 __noreturn void assertion_failed(const char *expr, const char *file, int line)
@@ -207,17 +925,44 @@ __noreturn void assertion_failed(const char *expr, const char *file, int line)
 struct cipherbench_params g_params = {
 	.bufsize = 4096,
 	.ntries = 5,
+	.warmup = 1,
+	.max_ntries = 100,
+	.ci_target = 1.0,
 };
 
 enum {
+	OPT_ASYNC,
+	OPT_BATCH,
 	OPT_BUFSIZE,
+	OPT_BUFSIZE_SWEEP,
+	OPT_CI,
+	OPT_COLD_KEYS,
+	OPT_FORMAT,
+	OPT_IMPL,
+	OPT_LATENCY,
+	OPT_MAX_NTRIES,
 	OPT_NTRIES,
+	OPT_THREADS,
+	OPT_WARMUP,
+	OPT_WORKING_SET,
 	OPT_HELP,
 };
 
 static const struct option longopts[] = {
+	{ "async", required_argument, NULL, OPT_ASYNC },
+	{ "batch", required_argument, NULL, OPT_BATCH },
 	{ "bufsize", required_argument, NULL, OPT_BUFSIZE },
+	{ "bufsize-sweep", required_argument, NULL, OPT_BUFSIZE_SWEEP },
+	{ "ci", required_argument, NULL, OPT_CI },
+	{ "cold-keys", optional_argument, NULL, OPT_COLD_KEYS },
+	{ "format", required_argument, NULL, OPT_FORMAT },
+	{ "impl", required_argument, NULL, OPT_IMPL },
+	{ "latency", optional_argument, NULL, OPT_LATENCY },
+	{ "max-ntries", required_argument, NULL, OPT_MAX_NTRIES },
 	{ "ntries", required_argument, NULL, OPT_NTRIES },
+	{ "threads", required_argument, NULL, OPT_THREADS },
+	{ "warmup", required_argument, NULL, OPT_WARMUP },
+	{ "working-set", optional_argument, NULL, OPT_WORKING_SET },
 	{ "help", no_argument, NULL, OPT_HELP },
 	{ NULL, 0, NULL, 0 },
 };
@@ -232,32 +977,128 @@ static void show_available_ciphers(void)
 	fprintf(stderr, "\n");
 }
 
+static void show_available_impls(void)
+{
+	int i;
+
+	fprintf(stderr, "Available implementations:");
+	for (i = 0; i < cpu_num_impls; i++)
+		fprintf(stderr, " %s", cpu_impls[i].name);
+	fprintf(stderr, "\n");
+}
+
 static void usage(void)
 {
 	static const char * const s =
 "Usage: cipherbench [OPTION...] [CIPHER]...\n"
 "Options:\n"
+"  --async=NWORKERS\n"
+"  --batch=NSECTORS\n"
 "  --bufsize=BUFSIZE\n"
-"  --ntries=NTRIES\n"
+"  --bufsize-sweep=MIN:MAX:STEP (STEP is +N or xN)\n"
+"  --ci=PERCENT (run until the 95% confidence interval is this tight)\n"
+"  --cold-keys[=NKEYS] (cycle through NKEYS keys, default: twice the LLC)\n"
+"  --format=text|json|csv\n"
+"  --impl=IMPL (limit the SIMD code used to that of IMPL)\n"
+"  --latency[=NCALLS] (also time NCALLS single calls, default 10000)\n"
+"  --max-ntries=NTRIES\n"
+"  --ntries=NTRIES (the minimum number of runs)\n"
+"  --threads=NTHREADS (or 'all')\n"
+"  --warmup=NRUNS\n"
+"  --working-set[=SIZE,...] (default: sized for each cache level and DRAM)\n"
 "  --help\n";
 
 	fputs(s, stderr);
 	show_available_ciphers();
+	show_available_impls();
 	exit(1);
 }
 
 int main(int argc, char *argv[])
 {
+	const char *impl = NULL;
 	int i;
 	int c;
 
 	while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
 		switch (c) {
+		case OPT_ASYNC:
+			g_params.async_workers = atoi(optarg);
+			break;
+		case OPT_BATCH:
+			g_params.batch_sectors = atoi(optarg);
+			break;
 		case OPT_BUFSIZE:
 			g_params.bufsize = atoi(optarg);
 			break;
+		case OPT_BUFSIZE_SWEEP:
+			if (!parse_sweep(optarg)) {
+				fprintf(stderr, "Invalid sweep: '%s'\n",
+					optarg);
+				usage();
+			}
+			break;
+		case OPT_CI:
+			g_params.ci_target = atof(optarg);
+			break;
+		case OPT_COLD_KEYS:
+			g_params.cold_keys = optarg ? atoi(optarg) :
+					     default_cold_keys();
+			if (g_params.cold_keys < 1)
+				usage();
+			break;
+		case OPT_FORMAT:
+			if (!strcmp(optarg, "text")) {
+				g_params.format = FORMAT_TEXT;
+			} else if (!strcmp(optarg, "json")) {
+				g_params.format = FORMAT_JSON;
+			} else if (!strcmp(optarg, "csv")) {
+				g_params.format = FORMAT_CSV;
+			} else {
+				fprintf(stderr, "Unknown format: '%s'\n",
+					optarg);
+				usage();
+			}
+			break;
+		case OPT_IMPL:
+			impl = optarg;
+			if (!cpu_set_impl(impl)) {
+				fprintf(stderr, "Unknown implementation: '%s'\n",
+					impl);
+				show_available_impls();
+				exit(1);
+			}
+			break;
+		case OPT_LATENCY:
+			g_params.latency_calls = optarg ? atoi(optarg) : 10000;
+			if (g_params.latency_calls < 1)
+				usage();
+			break;
+		case OPT_MAX_NTRIES:
+			g_params.max_ntries = atoi(optarg);
+			break;
 		case OPT_NTRIES:
 			g_params.ntries = atoi(optarg);
+			if (g_params.ntries < 1)
+				usage();
+			break;
+		case OPT_THREADS:
+			if (!strcmp(optarg, "all"))
+				g_params.threads = get_num_cpus();
+			else
+				g_params.threads = atoi(optarg);
+			break;
+		case OPT_WARMUP:
+			g_params.warmup = atoi(optarg);
+			break;
+		case OPT_WORKING_SET:
+			if (!optarg) {
+				add_default_working_sets();
+			} else if (!parse_working_sets(optarg)) {
+				fprintf(stderr, "Invalid working sets: '%s'\n",
+					optarg);
+				usage();
+			}
 			break;
 		case OPT_HELP:
 		default:
@@ -280,20 +1121,78 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * With a machine-readable format, only the results go to stdout.  The
+	 * rest of the output, which comes from many places, goes to stderr.
+	 */
+	if (g_params.format != FORMAT_TEXT) {
+		fflush(stdout);
+		results_file = fdopen(dup(STDOUT_FILENO), "w");
+		if (!results_file || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			fprintf(stderr, "Unable to redirect stdout: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+	}
+
+	init_cpu_features();
 	configure_cpu();
+	measure_init();
+	get_cpu_model();
 
 	printf("Benchmark parameters:\n");
-	printf("\tbufsize\t\t%d\n", g_params.bufsize);
+	if (sweep_max)
+		printf("\tbufsize\t\t%d to %d, %s %g\n", sweep_min, sweep_max,
+		       sweep_geometric ? "times" : "plus", sweep_step);
+	else
+		printf("\tbufsize\t\t%d\n", g_params.bufsize);
 	printf("\tntries\t\t%d\n", g_params.ntries);
-	printf("\n");
+	printf("\tmax_ntries\t%d\n", max(g_params.ntries, g_params.max_ntries));
+	printf("\twarmup\t\t%d\n", g_params.warmup);
+	printf("\tci\t\t%g%%\n", g_params.ci_target);
+	printf("\tcycles\t\t%s\n", measure_cycle_source() ?:
+	       (cpu_frequency_kHz ? "time * CPU frequency" : "unknown"));
+	if (impl)
+		printf("\timpl\t\t%s\n", impl);
+	if (g_params.batch_sectors)
+		printf("\tbatch\t\t%d\n", g_params.batch_sectors);
+	if (g_params.threads)
+		printf("\tthreads\t\t%d\n", g_params.threads);
+	if (g_params.async_workers)
+		printf("\tasync\t\t%d\n", g_params.async_workers);
+	if (g_params.cold_keys)
+		printf("\tcold keys\t%d\n", g_params.cold_keys);
+	if (g_params.latency_calls)
+		printf("\tlatency\t\t%d calls\n", g_params.latency_calls);
+	for (i = 0; i < g_params.num_working_sets; i++) {
+		char label[64];
 
-	if (argc) {
-		for (i = 0; i < argc; i++)
-			find_cipher(argv[i])->test_func();
-	} else {
-		for (i = 0; i < ARRAY_SIZE(ciphers); i++)
-			ciphers[i].test_func();
+		working_set_label(&g_params.working_sets[i], label,
+				  sizeof(label));
+		printf("\tworking set\t%s\n", label);
 	}
+	printf("\n");
+
+	if (sweep_max)
+		g_params.bufsize = sweep_min;
+	begin_results();
+
+	do {
+		if (sweep_max)
+			printf("Message size: %d bytes\n\n", g_params.bufsize);
+		chacha_autotune();
+		if (argc) {
+			for (i = 0; i < argc; i++)
+				find_cipher(argv[i])->test_func();
+		} else {
+			for (i = 0; i < ARRAY_SIZE(ciphers); i++)
+				ciphers[i].test_func();
+		}
+		g_params.bufsize = next_sweep_size(g_params.bufsize);
+	} while (g_params.bufsize <= sweep_max);
+	if (sweep_max)
+		show_sweep_report();
+	end_results();
 	deconfigure_cpu();
 	return 0;
 }
@@ -7,6 +7,8 @@
  */
 #pragma once
 
+#include <stddef.h>
+
 void test_adiantum(void);
 void test_aes(void);
 void test_chacha(void);
@@ -16,6 +18,7 @@ void test_chaskey_lts(void);
 void test_hpolyc(void);
 void test_lea(void);
 void test_nh(void);
+void test_nhpoly1305(void);
 void test_noekeon(void);
 void test_poly1305(void);
 void test_rc5(void);
@@ -23,9 +26,37 @@ void test_rc6(void);
 void test_speck(void);
 void test_xtea(void);
 
+enum output_format {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_CSV,
+};
+
+/* A total size of source and destination buffers to spread messages over */
+struct working_set {
+	const char *name;	/* the cache it's sized for, or NULL */
+	size_t size;
+};
+
+#define MAX_WORKING_SETS	8
+
 struct cipherbench_params {
+	enum output_format format;
 	int bufsize;
 	int ntries;
+	int warmup;
+	int max_ntries;
+	double ci_target;	/* percent of the mean */
+	int latency_calls;
+	int num_working_sets;
+	struct working_set working_sets[MAX_WORKING_SETS];
+	int batch_sectors;
+	int threads;
+	int async_workers;
+	int cold_keys;
 };
 
 extern struct cipherbench_params g_params;
+
+int get_num_cpus(void);
+void working_set_label(const struct working_set *ws, char *buf, size_t size);
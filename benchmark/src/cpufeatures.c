@@ -0,0 +1,169 @@
+/*
+ * Runtime CPU feature detection
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include "cpufeatures.h"
+
+#if defined(__x86_64__)
+#  include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#  include <asm/hwcap.h>
+#  include <sys/auxv.h>
+#endif
+
+u32 _cpu_features;
+
+#ifdef __x86_64__
+
+/* XCR0 bits: the OS saves and restores these register sets */
+#define XSTATE_SSE		(1U << 1)
+#define XSTATE_YMM		(1U << 2)
+#define XSTATE_OPMASK		(1U << 5)
+#define XSTATE_ZMM_HI256	(1U << 6)
+#define XSTATE_HI16_ZMM		(1U << 7)
+
+static u64 read_xcr0(void)
+{
+	u32 lo, hi;
+
+	__asm__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return ((u64)hi << 32) | lo;
+}
+
+static u32 get_cpu_features(void)
+{
+	u32 max_leaf, a, b, c, d;
+	u32 features = 0;
+	u64 xcr0 = 0;
+
+	max_leaf = __get_cpuid_max(0, NULL);
+	if (max_leaf < 1)
+		return features;
+
+	__cpuid(1, a, b, c, d);
+	if (c & bit_SSSE3)
+		features |= X86_FEATURE_SSSE3;
+	if (c & bit_AES)
+		features |= X86_FEATURE_AES;
+	if (c & bit_PCLMUL)
+		features |= X86_FEATURE_PCLMULQDQ;
+	if (c & bit_OSXSAVE)
+		xcr0 = read_xcr0();
+	if ((c & bit_AVX) &&
+	    (xcr0 & (XSTATE_SSE | XSTATE_YMM)) == (XSTATE_SSE | XSTATE_YMM))
+		features |= X86_FEATURE_AVX;
+
+	if (max_leaf < 7 || !(features & X86_FEATURE_AVX))
+		return features;
+
+	__cpuid_count(7, 0, a, b, c, d);
+	if (b & bit_AVX2)
+		features |= X86_FEATURE_AVX2;
+	if (c & bit_VAES)
+		features |= X86_FEATURE_VAES;
+	if (c & bit_VPCLMULQDQ)
+		features |= X86_FEATURE_VPCLMULQDQ;
+	if ((b & bit_AVX512F) &&
+	    (xcr0 & (XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM)) ==
+	    (XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM)) {
+		features |= X86_FEATURE_AVX512F;
+		if (b & bit_AVX512VL)
+			features |= X86_FEATURE_AVX512VL;
+		if (b & bit_AVX512BW)
+			features |= X86_FEATURE_AVX512BW;
+	}
+	return features;
+}
+
+#elif defined(__aarch64__)
+
+static u32 get_cpu_features(void)
+{
+	u32 features = 0;
+#ifdef __linux__
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	if (hwcap & HWCAP_AES)
+		features |= ARM64_FEATURE_AES;
+	if (hwcap & HWCAP_PMULL)
+		features |= ARM64_FEATURE_PMULL;
+#else
+	/* No portable way to ask; trust the compiler's target instead. */
+#  if defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)
+	features |= ARM64_FEATURE_AES | ARM64_FEATURE_PMULL;
+#  endif
+#endif
+	return features;
+}
+
+#else
+
+static u32 get_cpu_features(void)
+{
+	return 0;
+}
+
+#endif
+
+const struct cpu_impl cpu_impls[] = {
+	{ "native",	~0U },
+#if defined(__x86_64__)
+	{ "sse2",	0 },
+	{ "ssse3",	X86_FEATURE_SSSE3 | X86_FEATURE_AES |
+			X86_FEATURE_PCLMULQDQ },
+	{ "avx2",	X86_FEATURE_SSSE3 | X86_FEATURE_AES |
+			X86_FEATURE_PCLMULQDQ | X86_FEATURE_AVX |
+			X86_FEATURE_AVX2 },
+	/* VAES and VPCLMULQDQ first came with AVX-512, so they go with it */
+	{ "avx512",	X86_FEATURE_SSSE3 | X86_FEATURE_AES |
+			X86_FEATURE_PCLMULQDQ | X86_FEATURE_AVX |
+			X86_FEATURE_AVX2 | X86_FEATURE_AVX512F |
+			X86_FEATURE_AVX512VL | X86_FEATURE_AVX512BW |
+			X86_FEATURE_VAES | X86_FEATURE_VPCLMULQDQ },
+#elif defined(__aarch64__)
+	{ "neon",	0 },
+	{ "ce",		ARM64_FEATURE_AES | ARM64_FEATURE_PMULL },
+#endif
+};
+const int cpu_num_impls = ARRAY_SIZE(cpu_impls);
+
+static u32 allowed_features = ~0U;
+
+void init_cpu_features(void)
+{
+	_cpu_features = (get_cpu_features() & allowed_features) |
+			CPU_FEATURES_KNOWN;
+}
+
+/* Select the implementation level @name; return false if it's unknown */
+bool cpu_set_impl(const char *name)
+{
+	int i;
+
+	for (i = 0; i < cpu_num_impls; i++) {
+		if (!strcasecmp(name, cpu_impls[i].name)) {
+			allowed_features = cpu_impls[i].features;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef __x86_64__
+const char *x86_simd_impl_name(void)
+{
+	if (cpu_have_features(X86_FEATURE_AVX512F))
+		return "AVX-512";
+	if (cpu_have_features(X86_FEATURE_AVX2))
+		return "AVX2";
+	if (cpu_have_features(X86_FEATURE_SSSE3))
+		return "SSSE3";
+	return "SSE2";
+}
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Runtime CPU feature detection
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#pragma once
+
+#include "util.h"
+
+#if defined(__x86_64__)
+#  define X86_FEATURE_SSSE3		(1U << 0)
+#  define X86_FEATURE_AES		(1U << 1)
+#  define X86_FEATURE_PCLMULQDQ		(1U << 2)
+#  define X86_FEATURE_AVX		(1U << 3)
+#  define X86_FEATURE_AVX2		(1U << 4)
+#  define X86_FEATURE_AVX512F		(1U << 5)
+#  define X86_FEATURE_AVX512VL		(1U << 6)
+#  define X86_FEATURE_VAES		(1U << 7)
+#  define X86_FEATURE_VPCLMULQDQ	(1U << 8)
+#  define X86_FEATURE_AVX512BW		(1U << 9)
+#elif defined(__aarch64__)
+#  define ARM64_FEATURE_AES		(1U << 0)
+#  define ARM64_FEATURE_PMULL		(1U << 1)
+#endif
+
+/*
+ * Always set once the features have been detected.  main() does that before
+ * any benchmark runs, so that the worker threads only ever read the features.
+ */
+#define CPU_FEATURES_KNOWN	(1U << 31)
+
+extern u32 _cpu_features;
+void init_cpu_features(void);
+
+/*
+ * An implementation level that can be selected with --impl, e.g. to benchmark
+ * the AVX2 code on a CPU that also supports AVX-512.  Only the features in
+ * @features, and only if the CPU has them, are reported as available.
+ */
+struct cpu_impl {
+	const char *name;
+	u32 features;
+};
+
+extern const struct cpu_impl cpu_impls[];
+extern const int cpu_num_impls;
+
+/* Select the implementation level @name before init_cpu_features() */
+bool cpu_set_impl(const char *name);
+
+/*
+ * Return true if the CPU (and the OS, for the features that need extended
+ * register state) supports all of @features.
+ */
+static inline bool cpu_have_features(u32 features)
+{
+	ASSERT(_cpu_features & CPU_FEATURES_KNOWN);
+	return (_cpu_features & features) == features;
+}
+
+#ifdef __x86_64__
+/* The widest x86 SIMD instruction set that cpu_have_features() permits */
+const char *x86_simd_impl_name(void);
+#  undef SIMD_IMPL_NAME
+#  define SIMD_IMPL_NAME x86_simd_impl_name()
+#endif
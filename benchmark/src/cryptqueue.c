@@ -0,0 +1,280 @@
+/*
+ * Asynchronous submit/complete queue for HBSH encryption
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include "cryptqueue.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/*
+ * Bounded lock-free ring of pointers which any number of threads may push to
+ * and pop from (Dmitry Vyukov's MPMC queue).  Each slot has a sequence number
+ * which says whether it's free for the push at position 'pos' (seq == pos) or
+ * holds the item for the pop at position 'pos' (seq == pos + 1).  Pushers and
+ * poppers claim positions with a CAS on their own cacheline-aligned counter, so
+ * they only contend with each other when the ring is nearly empty or full.
+ */
+struct ring_slot {
+	atomic_size_t seq;
+	void *item;
+};
+
+struct ring {
+	struct ring_slot *slots;
+	size_t mask;
+	atomic_size_t push_pos __cacheline_aligned;
+	atomic_size_t pop_pos __cacheline_aligned;
+};
+
+static void ring_init(struct ring *r, size_t size)
+{
+	size_t i;
+
+	ASSERT(size != 0 && (size & (size - 1)) == 0);
+	r->slots = malloc(size * sizeof(r->slots[0]));
+	ASSERT(r->slots != NULL);
+	r->mask = size - 1;
+	for (i = 0; i < size; i++)
+		atomic_init(&r->slots[i].seq, i);
+	atomic_init(&r->push_pos, 0);
+	atomic_init(&r->pop_pos, 0);
+}
+
+static bool ring_push(struct ring *r, void *item)
+{
+	size_t pos = atomic_load_explicit(&r->push_pos, memory_order_relaxed);
+	struct ring_slot *slot;
+
+	for (;;) {
+		size_t seq;
+
+		slot = &r->slots[pos & r->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(
+					&r->push_pos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if ((ssize_t)(seq - pos) < 0) {
+			return false;	/* full */
+		} else {
+			pos = atomic_load_explicit(&r->push_pos,
+						   memory_order_relaxed);
+		}
+	}
+	slot->item = item;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	return true;
+}
+
+static void *ring_pop(struct ring *r)
+{
+	size_t pos = atomic_load_explicit(&r->pop_pos, memory_order_relaxed);
+	struct ring_slot *slot;
+	void *item;
+
+	for (;;) {
+		size_t seq;
+
+		slot = &r->slots[pos & r->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq == pos + 1) {
+			if (atomic_compare_exchange_weak_explicit(
+					&r->pop_pos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if ((ssize_t)(seq - (pos + 1)) < 0) {
+			return NULL;	/* empty */
+		} else {
+			pos = atomic_load_explicit(&r->pop_pos,
+						   memory_order_relaxed);
+		}
+	}
+	item = slot->item;
+	atomic_store_explicit(&slot->seq, pos + r->mask + 1,
+			      memory_order_release);
+	return item;
+}
+
+/*
+ * Requests go from the submitter to the workers through 'sq' and back through
+ * 'cq'.  Each ring has room for 'depth' requests, and 'inflight' limits the
+ * number of requests in the queue to 'depth'.  That doesn't mean a push always
+ * finds its slot free, though: the workers pop from 'sq' concurrently, and a
+ * worker that has claimed a slot may not have released it yet while later
+ * requests have already been completed and reaped.  So pushes wait for their
+ * slot, which is only ever briefly.
+ *
+ * The rings themselves never block.  The semaphores count the items pushed to
+ * each ring and are only there so that idle threads can sleep rather than spin.
+ * (glibc's sem_post() doesn't enter the kernel unless someone is waiting.)
+ */
+struct crypt_queue {
+	struct ring sq;
+	struct ring cq;
+	unsigned int depth;
+	atomic_uint inflight __cacheline_aligned;
+	sem_t sq_items;
+	sem_t cq_items;
+	atomic_bool stop;
+	bool simd;
+	unsigned int nthreads;
+	pthread_t *threads;
+};
+
+static void sem_wait_nointr(sem_t *sem)
+{
+	while (sem_wait(sem) != 0)
+		ASSERT(errno == EINTR);
+}
+
+/*
+ * Pop an item that the semaphore says is there.  With several pushers, the
+ * item at the front can still be in the middle of being pushed even though one
+ * behind it is done, so the pop may briefly see an empty ring.
+ */
+static void *ring_pop_counted(struct ring *r)
+{
+	void *item;
+
+	while ((item = ring_pop(r)) == NULL)
+		sched_yield();
+	return item;
+}
+
+/*
+ * Push an item to a ring which has room for it, except that a popper may still
+ * be in the middle of releasing the slot the push goes to.
+ */
+static void ring_push_counted(struct ring *r, void *item)
+{
+	while (!ring_push(r, item))
+		sched_yield();
+}
+
+static void *crypt_queue_worker(void *p)
+{
+	struct crypt_queue *queue = p;
+
+	for (;;) {
+		struct crypt_request *req;
+
+		sem_wait_nointr(&queue->sq_items);
+		if (atomic_load(&queue->stop))
+			break;
+		req = ring_pop_counted(&queue->sq);
+		if (req->decrypt)
+			hbsh_decrypt(req->ctx, req->dst, req->src, req->len,
+				     req->tweak, req->tweak_len, queue->simd);
+		else
+			hbsh_encrypt(req->ctx, req->dst, req->src, req->len,
+				     req->tweak, req->tweak_len, queue->simd);
+		ring_push_counted(&queue->cq, req);
+		sem_post(&queue->cq_items);
+	}
+	return NULL;
+}
+
+struct crypt_queue *crypt_queue_create(unsigned int depth,
+				       unsigned int nthreads, bool simd)
+{
+	struct crypt_queue *queue;
+	size_t ring_size = 1;
+	unsigned int i;
+	int err;
+
+	ASSERT(depth >= 1);
+	ASSERT(nthreads >= 1);
+	while (ring_size < depth)
+		ring_size *= 2;
+
+	err = posix_memalign((void **)&queue, __alignof__(*queue),
+			     sizeof(*queue));
+	ASSERT(err == 0);
+	memset(queue, 0, sizeof(*queue));
+	ring_init(&queue->sq, ring_size);
+	ring_init(&queue->cq, ring_size);
+	queue->depth = depth;
+	atomic_init(&queue->inflight, 0);
+	sem_init(&queue->sq_items, 0, 0);
+	sem_init(&queue->cq_items, 0, 0);
+	atomic_init(&queue->stop, false);
+	queue->simd = simd;
+	queue->nthreads = nthreads;
+	queue->threads = malloc(nthreads * sizeof(queue->threads[0]));
+	ASSERT(queue->threads != NULL);
+	for (i = 0; i < nthreads; i++) {
+		err = pthread_create(&queue->threads[i], NULL,
+				     crypt_queue_worker, queue);
+		ASSERT(err == 0);
+	}
+	return queue;
+}
+
+void crypt_queue_destroy(struct crypt_queue *queue)
+{
+	unsigned int i;
+
+	ASSERT(atomic_load(&queue->inflight) == 0);
+
+	/* Wake each worker with nothing to do, which makes it exit */
+	atomic_store(&queue->stop, true);
+	for (i = 0; i < queue->nthreads; i++)
+		sem_post(&queue->sq_items);
+	for (i = 0; i < queue->nthreads; i++)
+		pthread_join(queue->threads[i], NULL);
+
+	sem_destroy(&queue->sq_items);
+	sem_destroy(&queue->cq_items);
+	free(queue->sq.slots);
+	free(queue->cq.slots);
+	free(queue->threads);
+	free(queue);
+}
+
+bool crypt_queue_submit(struct crypt_queue *queue, struct crypt_request *req)
+{
+	unsigned int n = atomic_load_explicit(&queue->inflight,
+					      memory_order_relaxed);
+
+	do {
+		if (n >= queue->depth)
+			return false;
+	} while (!atomic_compare_exchange_weak_explicit(&queue->inflight,
+							&n, n + 1,
+							memory_order_acquire,
+							memory_order_relaxed));
+
+	ring_push_counted(&queue->sq, req);
+	sem_post(&queue->sq_items);
+	return true;
+}
+
+unsigned int crypt_queue_reap(struct crypt_queue *queue,
+			      struct crypt_request **reqs, unsigned int max,
+			      bool wait)
+{
+	unsigned int n = 0;
+
+	while (n < max) {
+		if (n == 0 && wait)
+			sem_wait_nointr(&queue->cq_items);
+		else if (sem_trywait(&queue->cq_items) != 0)
+			break;
+		reqs[n++] = ring_pop_counted(&queue->cq);
+	}
+	atomic_fetch_sub_explicit(&queue->inflight, n, memory_order_release);
+	return n;
+}
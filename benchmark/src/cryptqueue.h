@@ -0,0 +1,54 @@
+/*
+ * Asynchronous submit/complete queue for HBSH encryption
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#pragma once
+
+#include "hbsh.h"
+
+struct crypt_queue;
+
+/*
+ * One message to encrypt or decrypt.  The caller owns the request and the
+ * buffers it points to until the request comes back from crypt_queue_reap().
+ */
+struct crypt_request {
+	const struct hbsh_ctx *ctx;
+	u8 *dst;
+	const u8 *src;
+	size_t len;
+	const u8 *tweak;
+	size_t tweak_len;
+	bool decrypt;
+	void *data;		/* for the caller's use */
+};
+
+/*
+ * Create a queue that allows up to @depth requests in flight, processed by
+ * @nthreads worker threads.  @simd selects the implementation the workers use.
+ */
+struct crypt_queue *crypt_queue_create(unsigned int depth,
+				       unsigned int nthreads, bool simd);
+
+/* All submitted requests must have been reaped */
+void crypt_queue_destroy(struct crypt_queue *queue);
+
+/*
+ * Submit a request without blocking.  Returns false if @depth requests are
+ * already in flight, in which case some must be reaped first.
+ */
+bool crypt_queue_submit(struct crypt_queue *queue, struct crypt_request *req);
+
+/*
+ * Take up to @max completed requests off the queue, in completion order.  If
+ * @wait is true, this blocks until at least one is available; the caller must
+ * then have at least one request in flight.  Returns the number reaped.
+ */
+unsigned int crypt_queue_reap(struct crypt_queue *queue,
+			      struct crypt_request **reqs, unsigned int max,
+			      bool wait);
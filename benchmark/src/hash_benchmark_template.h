@@ -9,6 +9,9 @@
 	const size_t bufsize = g_params.bufsize;
 	u8 *data = malloc(bufsize);
 	u8 digest[DIGEST_SIZE];
+#ifdef HASH_ALT
+	u8 digest_alt[DIGEST_SIZE];
+#endif
 #ifdef HASH_SIMD
 	u8 digest_simd[DIGEST_SIZE];
 #endif
@@ -17,11 +20,8 @@
 	KEY ctx;
 #endif
 	unsigned long i;
-	int try;
-	const int ntries = g_params.ntries;
 	const unsigned long nbytes = round_up(1000000, bufsize);
-	u64 start;
-	u64 best_time;
+	struct measurement m = { 0 };
 
 	rand_bytes(data, bufsize);
 
@@ -30,28 +30,53 @@
 	SETKEY(&ctx, key);
 #endif
 
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		start = now();
+	measure_begin(&m);
+	while (measure_more(&m)) {
+		measure_start(&m);
 		for (i = 0; i < nbytes; i += bufsize)
 			HASH(&ctx, data, bufsize, digest);
-		best_time = min(best_time, now() - start);
+		measure_stop(&m);
 	}
-	show_result(ALGNAME, "hashing", "generic", nbytes, best_time);
+#ifndef HASH_IMPL_NAME
+#  define HASH_IMPL_NAME	"generic"
+#endif
+	show_measurement(ALGNAME, "hashing", HASH_IMPL_NAME, nbytes, &m);
+
+#ifdef HASH_ALT
+#ifndef HASH_ALT_USABLE
+#  define HASH_ALT_USABLE	true
+#endif
+	if (HASH_ALT_USABLE) {
+		measure_begin(&m);
+		while (measure_more(&m)) {
+			measure_start(&m);
+			for (i = 0; i < nbytes; i += bufsize)
+				HASH_ALT(&ctx, data, bufsize, digest_alt);
+			measure_stop(&m);
+			ASSERT(!memcmp(digest, digest_alt, DIGEST_SIZE));
+		}
+		show_measurement(ALGNAME, "hashing", HASH_ALT_IMPL_NAME,
+				 nbytes, &m);
+	}
+#endif
 
 #ifdef HASH_SIMD
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		start = now();
+	measure_begin(&m);
+	while (measure_more(&m)) {
+		measure_start(&m);
 		for (i = 0; i < nbytes; i += bufsize)
 			HASH_SIMD(&ctx, data, bufsize, digest_simd);
-		best_time = min(best_time, now() - start);
+		measure_stop(&m);
 		ASSERT(!memcmp(digest, digest_simd, DIGEST_SIZE));
 	}
-	show_result(ALGNAME, "hashing", SIMD_IMPL_NAME, nbytes, best_time);
+#ifndef HASH_SIMD_IMPL_NAME
+#  define HASH_SIMD_IMPL_NAME	SIMD_IMPL_NAME
+#endif
+	show_measurement(ALGNAME, "hashing", HASH_SIMD_IMPL_NAME, nbytes, &m);
 #endif
 	putchar('\n');
 
+	measure_free(&m);
 	free(data);
 }
 
@@ -60,4 +85,9 @@
 #undef KEY
 #undef SETKEY
 #undef HASH
+#undef HASH_IMPL_NAME
+#undef HASH_ALT
+#undef HASH_ALT_IMPL_NAME
+#undef HASH_ALT_USABLE
 #undef HASH_SIMD
+#undef HASH_SIMD_IMPL_NAME
@@ -0,0 +1,110 @@
+/*
+ * HBSH encryption mode, including Adiantum and HPolyC
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#pragma once
+
+#include "aes.h"
+#include "chacha.h"
+#include "nh.h"
+#include "noekeon.h"
+#include "poly1305.h"
+
+#define HBSH_KEYSIZE			CHACHA_KEY_SIZE
+
+union hbsh_blkcipher_ctx {
+	struct aes_ctx aes;
+	struct noekeon_ctx noekeon;
+};
+
+/* An implementation of a 128-bit block cipher, for the middle step of HBSH */
+struct hbsh_blkcipher {
+	const char *name;	/* e.g. "AES" */
+	const char *impl;	/* e.g. "AES-NI", or NULL if the only one */
+	unsigned int keysize;
+	bool (*usable)(void);	/* NULL if always usable */
+	void (*setkey)(union hbsh_blkcipher_ctx *ctx, const u8 *key);
+	void (*encrypt)(const union hbsh_blkcipher_ctx *ctx,
+			u8 *out, const u8 *in);
+	void (*decrypt)(const union hbsh_blkcipher_ctx *ctx,
+			u8 *out, const u8 *in);
+};
+
+#define HBSH_BLKCIPHER_MAX_KEYSIZE	32
+
+/* All block cipher implementations, including ones the CPU doesn't support */
+extern const struct hbsh_blkcipher hbsh_blkciphers[];
+extern const size_t hbsh_num_blkciphers;
+
+bool hbsh_blkcipher_usable(const struct hbsh_blkcipher *blkcipher);
+
+/* AES-256, with the fastest implementation the CPU supports */
+const struct hbsh_blkcipher *hbsh_default_blkcipher(void);
+
+enum hbsh_hash_alg {
+	HBSH_HASH_HPOLYC,
+	HBSH_HASH_ADIANTUM,
+};
+
+struct hbsh_ctx {
+	struct chacha_ctx chacha;
+	const struct hbsh_blkcipher *blkcipher;
+	union hbsh_blkcipher_ctx blkcipher_ctx;
+	enum hbsh_hash_alg hash_alg;
+	unsigned int default_tweak_len;
+	union {
+		struct poly1305_key hpolyc;
+		struct adiantum_hash_key {
+			struct poly1305_key polyt;
+			struct poly1305_key poly;
+			struct nh_ctx nh;
+		} adiantum;
+	} hash;
+};
+
+void hbsh_setkey(struct hbsh_ctx *ctx, const u8 *key,
+		 int nrounds, enum hbsh_hash_alg hash_alg,
+		 const struct hbsh_blkcipher *blkcipher);
+
+/*
+ * Encrypt or decrypt one message of @nbytes bytes (at least 16) with a tweak of
+ * @tweak_len bytes.  In-place operation (dst == src) is allowed.
+ */
+void hbsh_encrypt(const struct hbsh_ctx *ctx, u8 *dst, const u8 *src,
+		  size_t nbytes, const u8 *tweak, size_t tweak_len, bool simd);
+void hbsh_decrypt(const struct hbsh_ctx *ctx, u8 *dst, const u8 *src,
+		  size_t nbytes, const u8 *tweak, size_t tweak_len, bool simd);
+
+/*
+ * Encrypt or decrypt @nsectors consecutive sectors of @sector_size bytes each,
+ * e.g. all the sectors of one bio.  The tweak of each sector is its sector
+ * number (starting at @first_sector) as a 64-bit little endian integer,
+ * zero-padded to the default tweak length; this matches the "plain64" IV
+ * generator of Linux's dm-crypt.  In-place operation (dst == src) is allowed.
+ */
+void hbsh_encrypt_sectors(const struct hbsh_ctx *ctx, u8 *dst, const u8 *src,
+			  size_t sector_size, size_t nsectors,
+			  u64 first_sector, bool simd);
+void hbsh_decrypt_sectors(const struct hbsh_ctx *ctx, u8 *dst, const u8 *src,
+			  size_t sector_size, size_t nsectors,
+			  u64 first_sector, bool simd);
+
+struct thread_pool;
+
+/*
+ * Same as hbsh_{en,de}crypt_sectors(), but spread the sectors over the threads
+ * of @pool.  This is meant for large extents, e.g. 1 MiB.
+ */
+void hbsh_encrypt_extent(struct thread_pool *pool,
+			 const struct hbsh_ctx *ctx, u8 *dst, const u8 *src,
+			 size_t sector_size, size_t nsectors,
+			 u64 first_sector, bool simd);
+void hbsh_decrypt_extent(struct thread_pool *pool,
+			 const struct hbsh_ctx *ctx, u8 *dst, const u8 *src,
+			 size_t sector_size, size_t nsectors,
+			 u64 first_sector, bool simd);
@@ -0,0 +1,425 @@
+/*
+ * Repeated timing of a benchmark until the result is stable
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "util.h"
+
+static const char *cycle_source;
+
+#ifdef __linux__
+static const struct {
+	const char *name;
+	u32 type;
+	u64 config;
+} perf_events[NUM_COUNTERS] = {
+	[COUNTER_CYCLES] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+	},
+	[COUNTER_INSTRUCTIONS] = {
+		"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+	},
+	[COUNTER_BRANCH_MISSES] = {
+		"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+	},
+	[COUNTER_L1D_MISSES] = {
+		"L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	},
+};
+
+/* The group leader, and each counter's index in a group read or -1 */
+static int perf_group_fd = -1;
+static int perf_index[NUM_COUNTERS] = { -1, -1, -1, -1 };
+static int perf_nr;
+
+static int perf_event_open(u32 type, u64 config, int group_fd)
+{
+	struct perf_event_attr attr = {
+		.size = sizeof(attr),
+		.type = type,
+		.config = config,
+		.read_format = PERF_FORMAT_GROUP,
+		.disabled = (group_fd < 0),
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+	};
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/*
+ * Count the events in one group, so that they're counted over the same time.
+ * Without cycles there's no point; the other events are optional.
+ */
+static bool perf_counters_open(void)
+{
+	int i, fd;
+
+	fd = perf_event_open(perf_events[COUNTER_CYCLES].type,
+			     perf_events[COUNTER_CYCLES].config, -1);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to count CPU cycles with perf_event_open: %s\n",
+			strerror(errno));
+		return false;
+	}
+	perf_group_fd = fd;
+	perf_index[COUNTER_CYCLES] = perf_nr++;
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (i == COUNTER_CYCLES)
+			continue;
+		fd = perf_event_open(perf_events[i].type, perf_events[i].config,
+				     perf_group_fd);
+		if (fd < 0) {
+			fprintf(stderr, "Unable to count %s: %s\n",
+				perf_events[i].name, strerror(errno));
+			continue;
+		}
+		perf_index[i] = perf_nr++;
+	}
+	ioctl(perf_group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+static void perf_counters_read(u64 counts[NUM_COUNTERS])
+{
+	u64 buf[1 + NUM_COUNTERS];
+	int i;
+
+	ASSERT(read(perf_group_fd, buf, sizeof(buf)) ==
+	       (1 + perf_nr) * sizeof(u64));
+	for (i = 0; i < NUM_COUNTERS; i++)
+		counts[i] = perf_index[i] >= 0 ? buf[1 + perf_index[i]] : 0;
+}
+#else /* __linux__ */
+static bool perf_counters_open(void)
+{
+	return false;
+}
+
+static void perf_counters_read(u64 counts[NUM_COUNTERS])
+{
+}
+#endif /* !__linux__ */
+
+#ifdef __x86_64__
+static u64 tsc_kHz;
+
+/* Measure the TSC frequency against CLOCK_MONOTONIC */
+static u64 measure_tsc_kHz(void)
+{
+	const u64 start_ns = now();
+	const u64 start_tsc = ticks();
+	u64 ns;
+
+	do {
+		ns = now() - start_ns;
+	} while (ns < 50000000);
+
+	return (ticks() - start_tsc) * 1000000 / ns;
+}
+#endif /* __x86_64__ */
+
+void measure_init(void)
+{
+#ifdef __x86_64__
+	tsc_kHz = measure_tsc_kHz();
+#endif
+	if (perf_counters_open()) {
+		cycle_source = "perf_event_open";
+		return;
+	}
+#ifdef __x86_64__
+	cycle_source = "TSC";
+	if (cpu_frequency_kHz == 0) {
+		cpu_frequency_kHz = tsc_kHz;
+		printf("Using TSC frequency: %"PRIu64".%03"PRIu64" MHz\n",
+		       cpu_frequency_kHz / 1000, cpu_frequency_kHz % 1000);
+	}
+#endif
+}
+
+u64 ticks_to_ns(u64 t)
+{
+#ifdef __x86_64__
+	return t * 1000000 / tsc_kHz;
+#else
+	return t;
+#endif
+}
+
+const char *measure_cycle_source(void)
+{
+	return cycle_source;
+}
+
+bool measure_have_counter(enum measure_counter counter)
+{
+	if (counter == COUNTER_CYCLES)
+		return cycle_source != NULL;
+#ifdef __linux__
+	return perf_group_fd >= 0 && perf_index[counter] >= 0;
+#else
+	return false;
+#endif
+}
+
+static void read_counters(u64 counts[NUM_COUNTERS])
+{
+	if (perf_group_fd >= 0) {
+		perf_counters_read(counts);
+		return;
+	}
+	memset(counts, 0, NUM_COUNTERS * sizeof(counts[0]));
+#ifdef __x86_64__
+	if (cycle_source)
+		counts[COUNTER_CYCLES] = ticks();
+#endif
+}
+
+/* 97.5th percentile of Student's t-distribution, by degrees of freedom */
+static const double t_975[] = {
+	0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+	2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+	2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+	2.042,
+};
+
+static double t_critical(int df)
+{
+	if (df < ARRAY_SIZE(t_975))
+		return t_975[df];
+	if (df < 60)
+		return 2.000;
+	if (df < 120)
+		return 1.980;
+	return 1.960;
+}
+
+static double mean_of(const u64 *times, int n)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += times[i];
+	return sum / n;
+}
+
+static double stddev_of(const u64 *times, int n, double mean)
+{
+	double sum = 0;
+	int i;
+
+	if (n < 2)
+		return 0;
+	for (i = 0; i < n; i++)
+		sum += (times[i] - mean) * (times[i] - mean);
+	return sqrt(sum / (n - 1));
+}
+
+/* Half-width of the 95% confidence interval of the mean */
+static double ci_half_width(int n, double stddev)
+{
+	if (n < 2)
+		return INFINITY;
+	return t_critical(n - 1) * stddev / sqrt(n);
+}
+
+void measure_begin(struct measurement *m)
+{
+	int capacity = max(g_params.ntries, g_params.max_ntries);
+
+	if (m->capacity < capacity) {
+		free(m->times);
+		free(m->counts);
+		m->times = malloc(capacity * sizeof(m->times[0]));
+		m->counts = malloc(capacity * sizeof(m->counts[0]));
+		ASSERT(m->times != NULL && m->counts != NULL);
+		m->capacity = capacity;
+	}
+	m->ntimes = 0;
+	m->nwarmup = g_params.warmup;
+}
+
+bool measure_more(const struct measurement *m)
+{
+	double mean;
+
+	if (m->nwarmup > 0 || m->ntimes < g_params.ntries)
+		return true;
+	if (m->ntimes >= m->capacity || g_params.ci_target <= 0)
+		return false;
+	mean = mean_of(m->times, m->ntimes);
+	return ci_half_width(m->ntimes,
+			     stddev_of(m->times, m->ntimes, mean)) >
+		mean * g_params.ci_target / 100;
+}
+
+void measure_start(struct measurement *m)
+{
+	if (m->time_only)
+		memset(m->start_counts, 0, sizeof(m->start_counts));
+	else
+		read_counters(m->start_counts);
+	m->start_ns = now();
+}
+
+void measure_stop(struct measurement *m)
+{
+	const u64 ns_elapsed = now() - m->start_ns;
+	u64 counts[NUM_COUNTERS] = { 0 };
+	int i;
+
+	if (!m->time_only)
+		read_counters(counts);
+	if (m->nwarmup > 0) {
+		m->nwarmup--;
+		return;
+	}
+	ASSERT(m->ntimes < m->capacity);
+	for (i = 0; i < NUM_COUNTERS; i++)
+		m->counts[m->ntimes][i] = counts[i] - m->start_counts[i];
+	m->times[m->ntimes++] = ns_elapsed;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of the sorted times */
+static u64 percentile(const u64 *sorted, int n, int p)
+{
+	return sorted[(p * (n - 1) + 50) / 100];
+}
+
+/* Sorts the times */
+void measure_get_stats(struct measurement *m, struct measurement_stats *stats)
+{
+	const u64 *t = m->times;
+	const int n = m->ntimes;
+	double q1, q3, iqr;
+	int best;
+	int i;
+
+	ASSERT(n > 0);
+
+	best = 0;
+	for (i = 1; i < n; i++) {
+		if (m->counts[i][COUNTER_CYCLES] <
+		    m->counts[best][COUNTER_CYCLES])
+			best = i;
+	}
+	memcpy(stats->counts, m->counts[best], sizeof(stats->counts));
+
+	qsort(m->times, n, sizeof(m->times[0]), cmp_u64);
+
+	stats->nsamples = n;
+	stats->best_ns = t[0];
+	stats->p5_ns = percentile(t, n, 5);
+	stats->median_ns = percentile(t, n, 50);
+	stats->p95_ns = percentile(t, n, 95);
+	stats->mean_ns = mean_of(t, n);
+	stats->stddev_ns = stddev_of(t, n, stats->mean_ns);
+	stats->ci_ns = n >= 2 ? ci_half_width(n, stats->stddev_ns) : 0;
+
+	q1 = percentile(t, n, 25);
+	q3 = percentile(t, n, 75);
+	iqr = q3 - q1;
+	stats->noutliers = 0;
+	for (i = 0; i < n; i++) {
+		if (t[i] < q1 - 1.5 * iqr || t[i] > q3 + 1.5 * iqr)
+			stats->noutliers++;
+	}
+}
+
+void measure_free(struct measurement *m)
+{
+	free(m->times);
+	free(m->counts);
+	m->times = NULL;
+	m->counts = NULL;
+	m->capacity = 0;
+}
+
+static int latency_bucket(u64 t)
+{
+	const int msb = 63 - __builtin_clzll(t | 1);
+	int shift;
+
+	if (t < 2 * LATENCY_SUB_BUCKETS)
+		return t;
+	shift = msb - LATENCY_SUB_BITS;
+	return ((shift + 1) << LATENCY_SUB_BITS) +
+		(t >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/* The highest value that goes in the bucket */
+static u64 latency_bucket_max(int bucket)
+{
+	int shift;
+
+	if (bucket < 2 * LATENCY_SUB_BUCKETS)
+		return bucket;
+	shift = (bucket >> LATENCY_SUB_BITS) - 1;
+	return (((u64)(bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) + 1)
+		<< shift) - 1;
+}
+
+void latency_reset(struct latency_histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void latency_record(struct latency_histogram *h, u64 t)
+{
+	h->counts[latency_bucket(t)]++;
+	h->total++;
+	h->max = max(h->max, t);
+}
+
+/* The value at or below which @p percent of the latencies are, in ns */
+static double latency_percentile(const struct latency_histogram *h, double p)
+{
+	const u64 rank = max((u64)ceil(h->total * p / 100), (u64)1);
+	u64 count = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+		count += h->counts[i];
+		if (count >= rank)
+			return ticks_to_ns(min(latency_bucket_max(i), h->max));
+	}
+	return ticks_to_ns(h->max);
+}
+
+void latency_get_stats(const struct latency_histogram *h,
+		       struct latency_stats *stats)
+{
+	ASSERT(h->total > 0);
+	stats->ncalls = h->total;
+	stats->p50_ns = latency_percentile(h, 50);
+	stats->p99_ns = latency_percentile(h, 99);
+	stats->p999_ns = latency_percentile(h, 99.9);
+	stats->max_ns = ticks_to_ns(h->max);
+}
@@ -84,6 +84,19 @@ void nh_generic(const u32 *key, const u8 *message, size_t message_len, u8 *hash)
 }
 #endif /* optimized generic version */
 
+void nh_multi_generic(const u32 *key, const u8 *message, size_t message_len,
+		      union nh_hash hashes[])
+{
+	while (message_len) {
+		size_t len = min(message_len, (size_t)NH_MESSAGE_BYTES);
+
+		nh_generic(key, message, len, hashes->bytes);
+		hashes++;
+		message += len;
+		message_len -= len;
+	}
+}
+
 void nh_setkey(struct nh_ctx *ctx, const u8 *key)
 {
 	int i;
@@ -94,20 +107,22 @@ void nh_setkey(struct nh_ctx *ctx, const u8 *key)
 
 static __always_inline void
 __nh_bulk(const struct nh_ctx *ctx, const void *data, unsigned int nbytes,
-	  u8 *digest, bool simd)
+	  u8 *digest,
+	  void (*nh_fn)(const u32 *key, const u8 *message, size_t message_len,
+			u8 *hash))
 {
 	u8 tmp_hash[NH_HASH_BYTES];
 
 	memset(digest, 0, NH_HASH_BYTES);
 	while (nbytes >= NH_MESSAGE_BYTES) {
-		nh(ctx->key, data, NH_MESSAGE_BYTES, tmp_hash, simd);
+		nh_fn(ctx->key, data, NH_MESSAGE_BYTES, tmp_hash);
 		/* bogus combining method, just for testing... */
 		xor(digest, digest, tmp_hash, NH_HASH_BYTES);
 		data += NH_MESSAGE_BYTES;
 		nbytes -= NH_MESSAGE_BYTES;
 	}
 	if (nbytes > 0) {
-		nh(ctx->key, data, nbytes, tmp_hash, simd);
+		nh_fn(ctx->key, data, nbytes, tmp_hash);
 		/* bogus combining method, just for testing... */
 		xor(digest, digest, tmp_hash, NH_HASH_BYTES);
 	}
@@ -116,17 +131,28 @@ __nh_bulk(const struct nh_ctx *ctx, const void *data, unsigned int nbytes,
 static void nh_bulk_generic(const struct nh_ctx *ctx, const void *data,
 			    unsigned int nbytes, u8 *digest)
 {
-	__nh_bulk(ctx, data, nbytes, digest, false);
+	__nh_bulk(ctx, data, nbytes, digest, nh_generic);
 }
 
 #ifdef HAVE_NH_SIMD
 static void nh_bulk_simd(const struct nh_ctx *ctx, const void *data,
 			 unsigned int nbytes, u8 *digest)
 {
-	__nh_bulk(ctx, data, nbytes, digest, true);
+	__nh_bulk(ctx, data, nbytes, digest, nh_simd);
 }
 #endif
 
+#ifdef __x86_64__
+/* What nh_simd() uses when the CPU doesn't support AVX-512 */
+static void nh_bulk_simd_fallback(const struct nh_ctx *ctx, const void *data,
+				  unsigned int nbytes, u8 *digest)
+{
+	__nh_bulk(ctx, data, nbytes, digest, nh_simd_fallback);
+}
+#undef SIMD_IMPL_NAME
+#define SIMD_IMPL_NAME	NH_SIMD_IMPL_NAME
+#endif
+
 struct nh_testvec {
 	struct testvec_buffer key;
 	struct testvec_buffer message;
@@ -173,10 +199,54 @@ static void fuzz_nh(void)
 		nh_simd(key, message, len, hash_simd);
 
 		ASSERT(!memcmp(hash_generic, hash_simd, NH_HASH_BYTES));
+#ifdef __x86_64__
+		memset(hash_simd, 0, NH_HASH_BYTES);
+		nh_simd_fallback(key, message, len, hash_simd);
+		ASSERT(!memcmp(hash_generic, hash_simd, NH_HASH_BYTES));
+#endif
 	}
 #endif
 }
 
+/* Check nh_multi() against nh() on each chunk, for both implementations */
+static void fuzz_nh_multi(void)
+{
+	const size_t maxlen = 4 * NH_MESSAGE_BYTES;
+	u32 key[NH_KEY_DWORDS];
+	u8 *message = malloc(maxlen);
+	union nh_hash expected[4], actual[4];
+	size_t len, i, nhashes;
+	int iter;
+
+	for (iter = 0; iter < 100; iter++) {
+		len = NH_MESSAGE_UNIT *
+		      (1 + rand() % (maxlen / NH_MESSAGE_UNIT));
+		nhashes = DIV_ROUND_UP(len, NH_MESSAGE_BYTES);
+		rand_bytes(key, NH_KEY_BYTES);
+		rand_bytes(message, len);
+
+		for (i = 0; i < nhashes; i++)
+			nh_generic(key, &message[i * NH_MESSAGE_BYTES],
+				   min(len - i * NH_MESSAGE_BYTES,
+				       (size_t)NH_MESSAGE_BYTES),
+				   expected[i].bytes);
+
+		nh_multi(key, message, len, actual, false);
+		ASSERT(!memcmp(expected, actual, nhashes * NH_HASH_BYTES));
+#ifdef HAVE_NH_SIMD
+		memset(actual, 0, sizeof(actual));
+		nh_multi(key, message, len, actual, true);
+		ASSERT(!memcmp(expected, actual, nhashes * NH_HASH_BYTES));
+#endif
+#ifdef __x86_64__
+		memset(actual, 0, sizeof(actual));
+		nh_multi_simd_fallback(key, message, len, actual[0].bytes);
+		ASSERT(!memcmp(expected, actual, nhashes * NH_HASH_BYTES));
+#endif
+	}
+	free(message);
+}
+
 static void test_nh_testvecs(void)
 {
 	size_t i;
@@ -189,6 +259,67 @@ static void test_nh_testvecs(void)
 	}
 
 	fuzz_nh();
+	fuzz_nh_multi();
+}
+
+static void do_benchmark_nh_multi(const struct nh_ctx *ctx, const u8 *data,
+				  size_t buflen, bool simd, bool multi)
+{
+	union nh_hash hashes[DIV_ROUND_UP(buflen, NH_MESSAGE_BYTES)];
+	char impl_name[64];
+	unsigned long i;
+	size_t j;
+	const unsigned long nbytes = round_up(1000000, buflen);
+	struct measurement m = { 0 };
+
+	measure_begin(&m);
+	while (measure_more(&m)) {
+		measure_start(&m);
+		for (i = 0; i < nbytes; i += buflen) {
+			if (multi) {
+				nh_multi(ctx->key, data, buflen, hashes, simd);
+				continue;
+			}
+			for (j = 0; j < buflen; j += NH_MESSAGE_BYTES)
+				nh(ctx->key, &data[j], NH_MESSAGE_BYTES,
+				   hashes[j / NH_MESSAGE_BYTES].bytes, simd);
+		}
+		measure_stop(&m);
+	}
+	sprintf(impl_name, "%s, %s, %zu-byte buffers",
+		simd ? SIMD_IMPL_NAME : "generic",
+		multi ? "nh_multi()" : "nh() per chunk", buflen);
+	show_measurement_msglen("NH", "hashing", impl_name, buflen, nbytes,
+				&m);
+	measure_free(&m);
+}
+
+/*
+ * Compare hashing a buffer one NH_MESSAGE_BYTES chunk per call with hashing it
+ * in one call to nh_multi(), for a page and for a 64 KiB buffer.
+ */
+static void benchmark_nh_multi(void)
+{
+	static const size_t buflens[] = { 4096, 65536 };
+	u8 *data = malloc(buflens[ARRAY_SIZE(buflens) - 1]);
+	u8 key[NH_KEY_BYTES];
+	struct nh_ctx ctx;
+	size_t i;
+
+	rand_bytes(key, sizeof(key));
+	nh_setkey(&ctx, key);
+	rand_bytes(data, buflens[ARRAY_SIZE(buflens) - 1]);
+
+	for (i = 0; i < ARRAY_SIZE(buflens); i++) {
+		do_benchmark_nh_multi(&ctx, data, buflens[i], false, false);
+		do_benchmark_nh_multi(&ctx, data, buflens[i], false, true);
+#ifdef HAVE_NH_SIMD
+		do_benchmark_nh_multi(&ctx, data, buflens[i], true, false);
+		do_benchmark_nh_multi(&ctx, data, buflens[i], true, true);
+#endif
+	}
+	putchar('\n');
+	free(data);
 }
 
 void test_nh(void)
@@ -200,9 +331,17 @@ void test_nh(void)
 #ifdef HAVE_NH_SIMD
 #  define HASH_SIMD	nh_bulk_simd
 #endif
+#ifdef __x86_64__
+/* Without AVX-512, this would be the same as the SIMD row */
+#  define HASH_ALT		nh_bulk_simd_fallback
+#  define HASH_ALT_IMPL_NAME	NH_FALLBACK_IMPL_NAME
+#  define HASH_ALT_USABLE	nh_avx512_usable()
+#endif
 #define KEY		struct nh_ctx
 #define SETKEY		nh_setkey
 #define KEY_BYTES	NH_KEY_BYTES
 #define DIGEST_SIZE	NH_HASH_BYTES
 #include "hash_benchmark_template.h"
+
+	benchmark_nh_multi();
 }
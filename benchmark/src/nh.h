@@ -21,6 +21,7 @@
 
 #ifndef __ASSEMBLER__
 
+#include "cpufeatures.h"
 #include "util.h"
 
 void nh_generic(const u32 *key, const u8 *message, size_t message_len,
@@ -35,6 +36,27 @@ void nh_generic(const u32 *key, const u8 *message, size_t message_len,
 void nh_neon(const u32 *key, const u8 *message,
 	     size_t message_len, u8 hash[NH_HASH_BYTES]);
 #define nh_simd nh_neon
+#define NH_SIMD_IMPL_NAME "NEON"
+
+#ifdef __aarch64__
+void nh_multi_neon(const u32 *key, const u8 *message,
+		   size_t message_len, u8 *hashes);
+#define nh_multi_simd nh_multi_neon
+#else
+/* The arm32 NH has no multi-chunk entry point, so call it once per chunk */
+static inline void nh_multi_simd(const u32 *key, const u8 *message,
+				 size_t message_len, u8 *hashes)
+{
+	while (message_len) {
+		size_t len = min(message_len, (size_t)NH_MESSAGE_BYTES);
+
+		nh_neon(key, message, len, hashes);
+		hashes += NH_HASH_BYTES;
+		message += len;
+		message_len -= len;
+	}
+}
+#endif
 
 #elif defined(__x86_64__)
 
@@ -44,13 +66,62 @@ void nh_sse2(const u32 *key, const u8 *message,
 	     size_t message_len, u8 hash[NH_HASH_BYTES]);
 void nh_avx2(const u32 *key, const u8 *message,
 	     size_t message_len, u8 hash[NH_HASH_BYTES]);
-#ifdef __AVX2__
-#  define nh_simd nh_avx2
-#  define SIMD_IMPL_NAME "AVX2"
-#else
-#  define nh_simd nh_sse2
-#  define SIMD_IMPL_NAME "SSE2"
-#endif
+void nh_multi_sse2(const u32 *key, const u8 *message,
+		   size_t message_len, u8 *hashes);
+void nh_multi_avx2(const u32 *key, const u8 *message,
+		   size_t message_len, u8 *hashes);
+void nh_avx512(const u32 *key, const u8 *message,
+	       size_t message_len, u8 hash[NH_HASH_BYTES]);
+void nh_multi_avx512(const u32 *key, const u8 *message,
+		     size_t message_len, u8 *hashes);
+
+/* Each kernel is only used if the CPU supports it; SSE2 is always available */
+static inline bool nh_avx512_usable(void)
+{
+	return cpu_have_features(X86_FEATURE_AVX2 | X86_FEATURE_AVX512F);
+}
+
+/* What nh_simd() uses when the CPU doesn't support AVX-512 */
+static inline void nh_simd_fallback(const u32 *key, const u8 *message,
+				    size_t message_len, u8 hash[NH_HASH_BYTES])
+{
+	if (cpu_have_features(X86_FEATURE_AVX2))
+		nh_avx2(key, message, message_len, hash);
+	else
+		nh_sse2(key, message, message_len, hash);
+}
+
+static inline void nh_multi_simd_fallback(const u32 *key, const u8 *message,
+					  size_t message_len, u8 *hashes)
+{
+	if (cpu_have_features(X86_FEATURE_AVX2))
+		nh_multi_avx2(key, message, message_len, hashes);
+	else
+		nh_multi_sse2(key, message, message_len, hashes);
+}
+
+#define NH_FALLBACK_IMPL_NAME \
+	(cpu_have_features(X86_FEATURE_AVX2) ? "AVX2" : "SSE2")
+#define NH_SIMD_IMPL_NAME \
+	(nh_avx512_usable() ? "AVX-512" : NH_FALLBACK_IMPL_NAME)
+
+static inline void nh_simd(const u32 *key, const u8 *message,
+			   size_t message_len, u8 hash[NH_HASH_BYTES])
+{
+	if (nh_avx512_usable())
+		nh_avx512(key, message, message_len, hash);
+	else
+		nh_simd_fallback(key, message, message_len, hash);
+}
+
+static inline void nh_multi_simd(const u32 *key, const u8 *message,
+				 size_t message_len, u8 *hashes)
+{
+	if (nh_avx512_usable())
+		nh_multi_avx512(key, message, message_len, hashes);
+	else
+		nh_multi_simd_fallback(key, message, message_len, hashes);
+}
 
 #endif
 
@@ -60,6 +131,14 @@ struct nh_ctx {
 
 void nh_setkey(struct nh_ctx *ctx, const u8 *key);
 
+union nh_hash {
+	u8 bytes[NH_HASH_BYTES];
+	__le64 sums[NH_NUM_PASSES];
+};
+
+void nh_multi_generic(const u32 *key, const u8 *message, size_t message_len,
+		      union nh_hash hashes[]);
+
 static inline void nh(const u32 *key, const u8 *message,
 		      size_t message_len, u8 *hash, bool simd)
 {
@@ -71,10 +150,22 @@ static inline void nh(const u32 *key, const u8 *message,
 		nh_generic(key, message, message_len, hash);
 }
 
-union nh_hash {
-	u8 bytes[NH_HASH_BYTES];
-	__le64 sums[NH_NUM_PASSES];
-};
+/*
+ * NH-hash each NH_MESSAGE_BYTES chunk of @message into consecutive entries of
+ * @hashes, in one call.  The last chunk may be shorter, but @message_len must be
+ * a nonzero multiple of NH_MESSAGE_UNIT.
+ */
+static inline void nh_multi(const u32 *key, const u8 *message,
+			    size_t message_len, union nh_hash hashes[],
+			    bool simd)
+{
+#ifdef HAVE_NH_SIMD
+	if (simd)
+		nh_multi_simd(key, message, message_len, hashes[0].bytes);
+	else
+#endif
+		nh_multi_generic(key, message, message_len, hashes);
+}
 
 static inline void nh_combine(union nh_hash *dst, const union nh_hash *src1,
 			      const union nh_hash *src2)
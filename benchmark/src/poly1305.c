@@ -62,6 +62,249 @@ static void poly1305_key_powers(struct poly1305_key *key)
 	}
 }
 
+#ifdef HAVE_POLY1305_GENERIC64
+/*
+ * Generic code for 64-bit hosts: the state and key powers are in base 2^44, as
+ * in poly1305-donna-64, so each block takes 9 64x64 => 128-bit multiplications
+ * rather than 25 32x32 => 64-bit ones.  The caller's state stays in base 2^26
+ * so that this can be mixed freely with the other implementations; it's
+ * converted on entry and exit.
+ */
+
+typedef unsigned __int128 u128;
+
+#define MASK44	0xfffffffffffULL
+#define MASK42	0x3ffffffffffULL
+
+/*
+ * Regroup the 26-bit limbs into 44, 44, and 42-bit limbs.  The limbs needn't be
+ * fully carried; any excess just carries over into the next 44-bit limb.
+ */
+static void poly1305_h26_to_h44(const u32 h[5], u64 g[3])
+{
+	g[0] = h[0] + ((u64)(h[1] & 0x3ffff) << 26);
+	g[1] = (h[1] >> 18) + ((u64)h[2] << 8) + ((u64)(h[3] & 0x3ff) << 34);
+	g[2] = (h[3] >> 10) + ((u64)h[4] << 16);
+}
+
+/*
+ * Inverse of the above.  'g' must be carried as poly1305_carry44() leaves it,
+ * i.e. g[0] < 2^44 and g[2] < 2^42, so only h[3] can exceed 2^26 - 1, by a
+ * negligible amount.
+ */
+static void poly1305_h44_to_h26(const u64 g[3], u32 h[5])
+{
+	h[0] = g[0] & 0x3ffffff;
+	h[1] = (g[0] >> 26) + ((g[1] & 0xff) << 18);
+	h[2] = (g[1] >> 8) & 0x3ffffff;
+	h[3] = (g[1] >> 34) + ((g[2] & 0xffff) << 10);
+	h[4] = g[2] >> 16;
+}
+
+void poly1305_h64_to_h26(const u64 h64[3], struct poly1305_state *state)
+{
+	state->h[0] = h64[0] & 0x3ffffff;
+	state->h[1] = (h64[0] >> 26) & 0x3ffffff;
+	state->h[2] = ((h64[0] >> 52) | (h64[1] << 12)) & 0x3ffffff;
+	state->h[3] = (h64[1] >> 14) & 0x3ffffff;
+	state->h[4] = (h64[1] >> 40) | (h64[2] << 24);
+}
+
+/* Split a message block into 44-bit limbs */
+static forceinline void poly1305_load44(const u8 *data, u64 hibit, u64 m[3])
+{
+	const u64 t0 = get_unaligned_le64(data + 0);
+	const u64 t1 = get_unaligned_le64(data + 8);
+
+	m[0] = t0 & MASK44;
+	m[1] = ((t0 >> 44) | (t1 << 20)) & MASK44;
+	m[2] = (t1 >> 24) | hibit;
+}
+
+/*
+ * d += h * r, without carrying, where 'r' is r0, r1, r2, 20*r1, 20*r2.  The
+ * factor 20 comes from 2^132 == 4*5 (mod 2^130 - 5).
+ */
+static forceinline void poly1305_mul44(u128 d[3], const u64 h[3],
+				       const u64 r[5])
+{
+	d[0] += (u128)h[0] * r[0] + (u128)h[1] * r[4] + (u128)h[2] * r[3];
+	d[1] += (u128)h[0] * r[1] + (u128)h[1] * r[0] + (u128)h[2] * r[4];
+	d[2] += (u128)h[0] * r[2] + (u128)h[1] * r[1] + (u128)h[2] * r[0];
+}
+
+/*
+ * Carry d0 => d1 => d2 => h0 => h1.  With h < 2^45 per limb going into at most
+ * two multiplications, the sums are < 2^96, so every carry fits in 64 bits.
+ * Afterwards h0 < 2^44, h1 < 2^44 + 2^13, and h2 < 2^42.
+ */
+static forceinline void poly1305_carry44(u128 d[3], u64 h[3])
+{
+	u64 c;
+
+	h[0] = (u64)d[0] & MASK44;
+	d[1] += (u64)(d[0] >> 44);
+	h[1] = (u64)d[1] & MASK44;
+	d[2] += (u64)(d[1] >> 44);
+	h[2] = (u64)d[2] & MASK42;
+	c = (u64)(d[2] >> 42);
+	h[0] += c * 5;
+	h[1] += h[0] >> 44;
+	h[0] &= MASK44;
+}
+
+static void poly1305_key_powers44(struct poly1305_key *key,
+				  const u8 *raw_key)
+{
+	const u64 t0 = get_unaligned_le64(raw_key + 0);
+	const u64 t1 = get_unaligned_le64(raw_key + 8);
+	u64 *r = key->powers44[0];
+	u64 *rr = key->powers44[1];
+	u128 d[3] = { 0, 0, 0 };
+
+	/* Clamp the key and split it into 44-bit limbs */
+	r[0] = t0 & 0xffc0fffffffULL;
+	r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+	r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+	r[3] = r[1] * 20;
+	r[4] = r[2] * 20;
+
+	poly1305_mul44(d, r, r);
+	poly1305_carry44(d, rr);
+	rr[3] = rr[1] * 20;
+	rr[4] = rr[2] * 20;
+
+	/*
+	 * The clamping clears the low 2 bits of r1, so r1 * 2^128 ==
+	 * (r1 / 4) * 2^130 == 5*r1/4 (mod 2^130 - 5) exactly.
+	 */
+	key->r64[0] = t0 & 0x0ffffffc0fffffffULL;
+	key->r64[1] = t1 & 0x0ffffffc0ffffffcULL;
+	key->r64[2] = key->r64[1] + (key->r64[1] >> 2);
+}
+
+/*
+ * Two blocks at a time are done as h = (h + m1)*r^2 + m2*r, so that the two
+ * multiplications are independent and can overlap.
+ */
+void poly1305_blocks_generic64(const struct poly1305_key *key,
+			       struct poly1305_state *state,
+			       const u8 *data, size_t nblocks, u32 hibit)
+{
+	const u64 *r = key->powers44[0];
+	const u64 *rr = key->powers44[1];
+	const u64 hb = (u64)hibit << 40;
+	u64 h[3], m[3];
+
+	if (nblocks == 0)
+		return;
+
+	poly1305_h26_to_h44(state->h, h);
+
+	for (; nblocks >= 2; nblocks -= 2) {
+		u128 d[3] = { 0, 0, 0 };
+
+		poly1305_load44(data, hb, m);
+		h[0] += m[0];
+		h[1] += m[1];
+		h[2] += m[2];
+		poly1305_mul44(d, h, rr);
+		poly1305_load44(data + POLY1305_BLOCK_SIZE, hb, m);
+		poly1305_mul44(d, m, r);
+		poly1305_carry44(d, h);
+		data += 2 * POLY1305_BLOCK_SIZE;
+	}
+	if (nblocks) {
+		u128 d[3] = { 0, 0, 0 };
+
+		poly1305_load44(data, hb, m);
+		h[0] += m[0];
+		h[1] += m[1];
+		h[2] += m[2];
+		poly1305_mul44(d, h, r);
+		poly1305_carry44(d, h);
+	}
+
+	poly1305_h44_to_h26(h, state->h);
+}
+
+/*
+ * Like poly1305_blocks_generic64(), but for @n independent messages of the same
+ * length under the same key.  The messages are done two at a time, each two
+ * blocks at a time, so four multiplications are independent and can overlap.
+ */
+void poly1305_blocks_multi_generic64(const struct poly1305_key *key,
+				     struct poly1305_state state[],
+				     const void * const data[], size_t nblocks,
+				     u32 hibit, unsigned int n)
+{
+	const u64 *r = key->powers44[0];
+	const u64 *rr = key->powers44[1];
+	const u64 hb = (u64)hibit << 40;
+	unsigned int i;
+
+	if (nblocks == 0)
+		return;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		const u8 *data0 = data[i];
+		const u8 *data1 = data[i + 1];
+		u64 h0[3], h1[3], m0[3], m1[3];
+		size_t j = nblocks;
+
+		poly1305_h26_to_h44(state[i].h, h0);
+		poly1305_h26_to_h44(state[i + 1].h, h1);
+
+		for (; j >= 2; j -= 2) {
+			u128 d0[3] = { 0, 0, 0 };
+			u128 d1[3] = { 0, 0, 0 };
+
+			poly1305_load44(data0, hb, m0);
+			poly1305_load44(data1, hb, m1);
+			h0[0] += m0[0];
+			h0[1] += m0[1];
+			h0[2] += m0[2];
+			h1[0] += m1[0];
+			h1[1] += m1[1];
+			h1[2] += m1[2];
+			poly1305_mul44(d0, h0, rr);
+			poly1305_mul44(d1, h1, rr);
+			poly1305_load44(data0 + POLY1305_BLOCK_SIZE, hb, m0);
+			poly1305_load44(data1 + POLY1305_BLOCK_SIZE, hb, m1);
+			poly1305_mul44(d0, m0, r);
+			poly1305_mul44(d1, m1, r);
+			poly1305_carry44(d0, h0);
+			poly1305_carry44(d1, h1);
+			data0 += 2 * POLY1305_BLOCK_SIZE;
+			data1 += 2 * POLY1305_BLOCK_SIZE;
+		}
+		if (j) {
+			u128 d0[3] = { 0, 0, 0 };
+			u128 d1[3] = { 0, 0, 0 };
+
+			poly1305_load44(data0, hb, m0);
+			poly1305_load44(data1, hb, m1);
+			h0[0] += m0[0];
+			h0[1] += m0[1];
+			h0[2] += m0[2];
+			h1[0] += m1[0];
+			h1[1] += m1[1];
+			h1[2] += m1[2];
+			poly1305_mul44(d0, h0, r);
+			poly1305_mul44(d1, h1, r);
+			poly1305_carry44(d0, h0);
+			poly1305_carry44(d1, h1);
+		}
+
+		poly1305_h44_to_h26(h0, state[i].h);
+		poly1305_h44_to_h26(h1, state[i + 1].h);
+	}
+	if (i < n)
+		poly1305_blocks_generic64(key, &state[i], data[i], nblocks,
+					  hibit);
+}
+#endif /* HAVE_POLY1305_GENERIC64 */
+
 void poly1305_setkey(struct poly1305_key *key, const u8 *raw_key)
 {
 	/* Clamp the Poly1305 key and split it into five 26-bit limbs */
@@ -73,93 +316,159 @@ void poly1305_setkey(struct poly1305_key *key, const u8 *raw_key)
 
 	/* Precompute key powers */
 	poly1305_key_powers(key);
+#ifdef HAVE_POLY1305_GENERIC64
+	poly1305_key_powers44(key, raw_key);
+#endif
+#ifdef __x86_64__
+	{
+		int i, j;
+
+		for (i = 0; i < 4; i++)
+			for (j = 0; j < 9; j++)
+				key->powers_x86[j][i] = key->powers[3 - i][j];
+	}
+#endif
+#ifdef __aarch64__
+	{
+		int j;
+
+		for (j = 0; j < 9; j++) {
+			key->powers_arm64[j][0] = key->powers[1][j];
+			key->powers_arm64[j][1] = key->powers[1][j];
+			key->powers_arm64[j][2] = key->powers[1][j];
+			key->powers_arm64[j][3] = key->powers[0][j];
+		}
+	}
+#endif
+}
+
+/*
+ * Add one message block to the unreduced hash state 'h' and multiply by 'r'.
+ * 's' holds 5 * r[1..4].
+ */
+static forceinline void poly1305_block_generic(u32 h[5], const u32 r[5],
+					       const u32 s[4], const u8 *data,
+					       u32 hibit)
+{
+	u64 d0, d1, d2, d3, d4;
+
+	/* Invariants: h0, h2, h3, h4 <= 2^26 - 1; h1 <= 2^26 + 63 */
+
+	/*
+	 * Add the next message block to 'h' using five 26-bit limbs,
+	 * without doing any carries yet.
+	 */
+	h[0] += (get_unaligned_le32(data +  0) >> 0) & 0x3ffffff;
+	h[1] += (get_unaligned_le32(data +  3) >> 2) & 0x3ffffff;
+	h[2] += (get_unaligned_le32(data +  6) >> 4) & 0x3ffffff;
+	h[3] += (get_unaligned_le32(data +  9) >> 6) & 0x3ffffff;
+	h[4] += (get_unaligned_le32(data + 12) >> 8) | hibit;
+
+	/*
+	 * Multiply 'h' by 'r', without carrying, and using the property
+	 * 2^130 == 5 (mod 2^130 - 5) to keep within the five limbs:
+	 *
+	 *     r4       r3       r2       r1       r0
+	 *  X  h4       h3       h2       h1       h0
+	 *     ------ --------------------------------
+	 *     h0*r4    h0*r3    h0*r2    h0*r1    h0*r0
+	 *     h1*r3    h1*r2    h1*r1    h1*r0    h1*5*r4
+	 *     h2*r2    h2*r1    h2*r0    h2*5*r4  h2*5*r3
+	 *     h3*r1    h3*r0    h3*5*r4  h3*5*r3  h3*5*r2
+	 *     h4*r0    h4*5*r4  h4*5*r3  h4*5*r2  h4*5*r1
+	 *
+	 * Even if we assume an unclamped key, the greatest possible sum
+	 * of products is in the rightmost column (d0) which can be up
+	 * to about 2^57.39.  The least is in the leftmost column (d4)
+	 * which can only be up to about 2^55.32.  Thus, the sums fit
+	 * well within 64-bit integers.
+	 */
+	d0 = ((u64)h[0] * r[0]) + ((u64)h[1] * s[3]) + ((u64)h[2] * s[2]) +
+	     ((u64)h[3] * s[1]) + ((u64)h[4] * s[0]);
+	d1 = ((u64)h[0] * r[1]) + ((u64)h[1] * r[0]) + ((u64)h[2] * s[3]) +
+	     ((u64)h[3] * s[2]) + ((u64)h[4] * s[1]);
+	d2 = ((u64)h[0] * r[2]) + ((u64)h[1] * r[1]) + ((u64)h[2] * r[0]) +
+	     ((u64)h[3] * s[3]) + ((u64)h[4] * s[2]);
+	d3 = ((u64)h[0] * r[3]) + ((u64)h[1] * r[2]) + ((u64)h[2] * r[1]) +
+	     ((u64)h[3] * r[0]) + ((u64)h[4] * s[3]);
+	d4 = ((u64)h[0] * r[4]) + ((u64)h[1] * r[3]) + ((u64)h[2] * r[2]) +
+	     ((u64)h[3] * r[1]) + ((u64)h[4] * r[0]);
+
+	/*
+	 * Carry h0 => h1 => h2 => h3 => h4 => h0 => h1, assuming no
+	 * more than 32 carry bits per limb -- that's guaranteed by all
+	 * sums being < 2^58 - 2^32.  d4 is moreover guaranteed to be
+	 * < (2^58 - 2^32) / 5, so the needed multiplication with 5 can
+	 * be done with 32-bit precision.
+	 *
+	 * We stop once h1 is reached the second time.  Then, h1 will be
+	 * <= 2^26 + 63, and all other limbs will be <= 2^26 - 1.
+	 */
+	d1 += (u32)(d0 >> 26);
+	h[0] = d0 & 0x3ffffff;
+	d2 += (u32)(d1 >> 26);
+	h[1] = d1 & 0x3ffffff;
+	d3 += (u32)(d2 >> 26);
+	h[2] = d2 & 0x3ffffff;
+	d4 += (u32)(d3 >> 26);
+	h[3] = d3 & 0x3ffffff;
+	h[0] += (u32)(d4 >> 26) * 5;
+	h[4] = d4 & 0x3ffffff;
+	h[1] += h[0] >> 26;
+	h[0] &= 0x3ffffff;
 }
 
 void poly1305_blocks_generic(const struct poly1305_key *key,
 			     struct poly1305_state *state,
 			     const u8 *data, size_t nblocks, u32 hibit)
 {
-	u32 h0 = state->h[0], h1 = state->h[1], h2 = state->h[2],
-	    h3 = state->h[3], h4 = state->h[4];
-	const u32 r0 = key->r[0], r1 = key->r[1], r2 = key->r[2],
-		  r3 = key->r[3], r4 = key->r[4];
-	const u32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
-	u64 d0, d1, d2, d3, d4;
+	u32 h[5] = { state->h[0], state->h[1], state->h[2], state->h[3],
+		     state->h[4] };
+	const u32 s[4] = { key->r[1] * 5, key->r[2] * 5, key->r[3] * 5,
+			   key->r[4] * 5 };
 
 	while (nblocks--) {
-		/* Invariants: h0, h2, h3, h4 <= 2^26 - 1; h1 <= 2^26 + 63 */
-
-		/*
-		 * Add the next message block to 'h' using five 26-bit limbs,
-		 * without doing any carries yet.
-		 */
-		h0 += (get_unaligned_le32(data +  0) >> 0) & 0x3ffffff;
-		h1 += (get_unaligned_le32(data +  3) >> 2) & 0x3ffffff;
-		h2 += (get_unaligned_le32(data +  6) >> 4) & 0x3ffffff;
-		h3 += (get_unaligned_le32(data +  9) >> 6) & 0x3ffffff;
-		h4 += (get_unaligned_le32(data + 12) >> 8) | hibit;
-
-		/*
-		 * Multiply 'h' by 'r', without carrying, and using the property
-		 * 2^130 == 5 (mod 2^130 - 5) to keep within the five limbs:
-		 *
-		 *     r4       r3       r2       r1       r0
-		 *  X  h4       h3       h2       h1       h0
-		 *     ------ --------------------------------
-		 *     h0*r4    h0*r3    h0*r2    h0*r1    h0*r0
-		 *     h1*r3    h1*r2    h1*r1    h1*r0    h1*5*r4
-		 *     h2*r2    h2*r1    h2*r0    h2*5*r4  h2*5*r3
-		 *     h3*r1    h3*r0    h3*5*r4  h3*5*r3  h3*5*r2
-		 *     h4*r0    h4*5*r4  h4*5*r3  h4*5*r2  h4*5*r1
-		 *
-		 * Even if we assume an unclamped key, the greatest possible sum
-		 * of products is in the rightmost column (d0) which can be up
-		 * to about 2^57.39.  The least is in the leftmost column (d4)
-		 * which can only be up to about 2^55.32.  Thus, the sums fit
-		 * well within 64-bit integers.
-		 */
-		d0 = ((u64)h0 * r0) + ((u64)h1 * s4) + ((u64)h2 * s3) +
-		     ((u64)h3 * s2) + ((u64)h4 * s1);
-		d1 = ((u64)h0 * r1) + ((u64)h1 * r0) + ((u64)h2 * s4) +
-		     ((u64)h3 * s3) + ((u64)h4 * s2);
-		d2 = ((u64)h0 * r2) + ((u64)h1 * r1) + ((u64)h2 * r0) +
-		     ((u64)h3 * s4) + ((u64)h4 * s3);
-		d3 = ((u64)h0 * r3) + ((u64)h1 * r2) + ((u64)h2 * r1) +
-		     ((u64)h3 * r0) + ((u64)h4 * s4);
-		d4 = ((u64)h0 * r4) + ((u64)h1 * r3) + ((u64)h2 * r2) +
-		     ((u64)h3 * r1) + ((u64)h4 * r0);
-
-		/*
-		 * Carry h0 => h1 => h2 => h3 => h4 => h0 => h1, assuming no
-		 * more than 32 carry bits per limb -- that's guaranteed by all
-		 * sums being < 2^58 - 2^32.  d4 is moreover guaranteed to be
-		 * < (2^58 - 2^32) / 5, so the needed multiplication with 5 can
-		 * be done with 32-bit precision.
-		 *
-		 * We stop once h1 is reached the second time.  Then, h1 will be
-		 * <= 2^26 + 63, and all other limbs will be <= 2^26 - 1.
-		 */
-		d1 += (u32)(d0 >> 26);
-		h0 = d0 & 0x3ffffff;
-		d2 += (u32)(d1 >> 26);
-		h1 = d1 & 0x3ffffff;
-		d3 += (u32)(d2 >> 26);
-		h2 = d2 & 0x3ffffff;
-		d4 += (u32)(d3 >> 26);
-		h3 = d3 & 0x3ffffff;
-		h0 += (u32)(d4 >> 26) * 5;
-		h4 = d4 & 0x3ffffff;
-		h1 += h0 >> 26;
-		h0 &= 0x3ffffff;
-
+		poly1305_block_generic(h, key->r, s, data, hibit);
 		data += POLY1305_BLOCK_SIZE;
 	}
 
-	state->h[0] = h0;
-	state->h[1] = h1;
-	state->h[2] = h2;
-	state->h[3] = h3;
-	state->h[4] = h4;
+	memcpy(state->h, h, sizeof(h));
+}
+
+/*
+ * Like poly1305_blocks_generic(), but for @n independent messages of the same
+ * length under the same key.  The messages are done two at a time, so that the
+ * CPU can overlap the multiplications of the two dependency chains.
+ */
+void poly1305_blocks_multi_generic(const struct poly1305_key *key,
+				   struct poly1305_state state[],
+				   const void * const data[], size_t nblocks,
+				   u32 hibit, unsigned int n)
+{
+	const u32 s[4] = { key->r[1] * 5, key->r[2] * 5, key->r[3] * 5,
+			   key->r[4] * 5 };
+	unsigned int i;
+	size_t j;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		u32 h0[5], h1[5];
+		const u8 *data0 = data[i];
+		const u8 *data1 = data[i + 1];
+
+		memcpy(h0, state[i].h, sizeof(h0));
+		memcpy(h1, state[i + 1].h, sizeof(h1));
+		for (j = 0; j < nblocks; j++) {
+			poly1305_block_generic(h0, key->r, s, data0, hibit);
+			poly1305_block_generic(h1, key->r, s, data1, hibit);
+			data0 += POLY1305_BLOCK_SIZE;
+			data1 += POLY1305_BLOCK_SIZE;
+		}
+		memcpy(state[i].h, h0, sizeof(h0));
+		memcpy(state[i + 1].h, h1, sizeof(h1));
+	}
+	if (i < n)
+		poly1305_blocks_generic(key, &state[i], data[i], nblocks,
+					hibit);
 }
 
 void poly1305_emit_generic(struct poly1305_state *state, le128 *out)
@@ -204,6 +513,82 @@ void poly1305_emit_generic(struct poly1305_state *state, le128 *out)
 	out->w32[3] = cpu_to_le32((h3 >> 18) | (h4 << 8));
 }
 
+#ifdef __x86_64__
+/*
+ * The AVX2 code does 4 blocks at a time and the SSE2 code 2 at a time.  Both
+ * need a few blocks to pay off their setup, so leave the rest of the blocks to
+ * the narrower code.
+ */
+void poly1305_blocks_x86(const struct poly1305_key *key,
+			 struct poly1305_state *state, const void *data,
+			 size_t nblocks, u32 hibit, bool avx2)
+{
+	size_t n;
+
+	if (avx2 && nblocks >= 4) {
+		n = round_down(nblocks, 4);
+		poly1305_blocks_avx2(state->h, data, n, hibit,
+				     key->powers_x86);
+		data += n * POLY1305_BLOCK_SIZE;
+		nblocks -= n;
+	}
+	if (nblocks >= 2) {
+		n = round_down(nblocks, 2);
+		poly1305_blocks_sse2(state->h, data, n, hibit,
+				     key->powers_x86);
+		data += n * POLY1305_BLOCK_SIZE;
+		nblocks -= n;
+	}
+	if (nblocks)
+		poly1305_blocks_generic(key, state, data, nblocks, hibit << 24);
+}
+
+/*
+ * With AVX2, 4 messages at a time go through the lane-per-message code, and any
+ * others through poly1305_blocks_avx2().  The lane-per-message code is faster
+ * on the short runs of blocks that Adiantum passes here (at most 32 blocks, and
+ * often just 2), but the per-message code catches up on longer runs since its
+ * lanes aren't in one dependency chain.  Without AVX2, the interleaved scalar
+ * code beats the SSE2 code at all lengths.
+ */
+#define POLY1305_LANES_MAX_BLOCKS	32
+
+void poly1305_blocks_multi_x86(const struct poly1305_key *key,
+			       struct poly1305_state state[],
+			       const void * const data[], size_t nblocks,
+			       u32 hibit, unsigned int n, bool avx2)
+{
+	u64 h[5][4];
+	unsigned int i = 0, j, k;
+
+	if (!avx2) {
+		poly1305_blocks_multi_generic64(key, state, data, nblocks,
+						hibit, n);
+		return;
+	}
+	if (nblocks && nblocks <= POLY1305_LANES_MAX_BLOCKS) {
+		for (; i + 4 <= n; i += 4) {
+			for (j = 0; j < 5; j++)
+				for (k = 0; k < 4; k++)
+					h[j][k] = state[i + k].h[j];
+			poly1305_blocks_lanes_avx2(h,
+						   (const u8 * const *)&data[i],
+						   nblocks, hibit,
+						   key->powers_x86);
+			for (j = 0; j < 5; j++)
+				for (k = 0; k < 4; k++)
+					state[i + k].h[j] = h[j][k];
+		}
+	}
+	for (; i < n; i++)
+		poly1305_blocks_x86(key, &state[i], data[i], nblocks, hibit,
+				    true);
+}
+
+#undef SIMD_IMPL_NAME
+#define SIMD_IMPL_NAME	(cpu_have_features(X86_FEATURE_AVX2) ? "AVX2" : "SSE2")
+#endif /* __x86_64__ */
+
 /* Poly1305 benchmarking */
 
 static void _poly1305(const struct poly1305_key *key, const void *src,
@@ -224,6 +609,31 @@ static void _poly1305_generic(const struct poly1305_key *key, const void *src,
 	_poly1305(key, src, srclen, digest, false);
 }
 
+#ifdef HAVE_POLY1305_GENERIC64
+/* The base 2^26 generic code, which 64-bit hosts don't use by default */
+static void _poly1305_generic26(const struct poly1305_key *key,
+				const void *src, unsigned int srclen,
+				u8 *digest)
+{
+	const size_t nblocks = srclen / POLY1305_BLOCK_SIZE;
+	const size_t tail = srclen % POLY1305_BLOCK_SIZE;
+	struct poly1305_state state;
+	le128 out;
+
+	poly1305_init(&state);
+	poly1305_blocks_generic(key, &state, src, nblocks, 1 << 24);
+	if (tail) {
+		u8 block[POLY1305_BLOCK_SIZE] = { 0 };
+
+		memcpy(block, src + nblocks * POLY1305_BLOCK_SIZE, tail);
+		block[tail] = 1;
+		poly1305_blocks_generic(key, &state, block, 1, 0);
+	}
+	poly1305_emit_generic(&state, &out);
+	memcpy(digest, &out, sizeof(out));
+}
+#endif
+
 #ifdef HAVE_POLY1305_SIMD
 static void _poly1305_simd(const struct poly1305_key *key, const void *src,
 			   unsigned int srclen, u8 *digest)
@@ -232,10 +642,102 @@ static void _poly1305_simd(const struct poly1305_key *key, const void *src,
 }
 #endif
 
+#if defined(HAVE_POLY1305_GENERIC64) || defined(HAVE_POLY1305_SIMD)
+/*
+ * Check the other implementations against the base 2^26 generic code on many
+ * message lengths, starting from a nonzero state.  The 64-bit generic code is
+ * also checked when it's followed by the base 2^26 code, since it converts the
+ * state.  On x86_64, also check the SSE2 code on its own, since the SIMD path
+ * uses it only for the last couple of blocks when AVX2 is available.  Also check
+ * poly1305_blocks_multi() on enough messages to use every path in it.
+ */
+static void fuzz_poly1305(void)
+{
+	struct poly1305_key key;
+	struct poly1305_state start, state;
+	struct poly1305_state states[5];
+	const void *msgs[ARRAY_SIZE(states)];
+	u8 raw_key[POLY1305_BLOCK_SIZE];
+	u8 data[64 * POLY1305_BLOCK_SIZE];
+	le128 expected, actual;
+	int iter;
+	size_t i;
+
+	for (iter = 0; iter < 500; iter++) {
+		size_t nblocks = rand() % (ARRAY_SIZE(data) /
+					   POLY1305_BLOCK_SIZE + 1);
+		u32 hibit = rand() % 2;
+
+		rand_bytes(raw_key, sizeof(raw_key));
+		poly1305_setkey(&key, raw_key);
+		rand_bytes(data, sizeof(data));
+		poly1305_init(&start);
+		poly1305_blocks_generic(&key, &start, data, 1, 1 << 24);
+		rand_bytes(data, sizeof(data));
+
+		state = start;
+		poly1305_blocks_generic(&key, &state, data, nblocks,
+					hibit << 24);
+		poly1305_emit_generic(&state, &expected);
+
+#ifdef HAVE_POLY1305_GENERIC64
+		state = start;
+		poly1305_blocks_generic64(&key, &state, data, nblocks, hibit);
+		poly1305_emit_generic(&state, &actual);
+		ASSERT(!memcmp(&expected, &actual, sizeof(actual)));
+
+		if (nblocks) {
+			size_t n = rand() % nblocks;
+
+			state = start;
+			poly1305_blocks_generic64(&key, &state, data, n,
+						  hibit);
+			poly1305_blocks_generic(&key, &state,
+						&data[n * POLY1305_BLOCK_SIZE],
+						nblocks - n, hibit << 24);
+			poly1305_emit_generic(&state, &actual);
+			ASSERT(!memcmp(&expected, &actual, sizeof(actual)));
+		}
+#endif
+#ifdef HAVE_POLY1305_SIMD
+		state = start;
+		poly1305_blocks_simd(&key, &state, data, nblocks, hibit);
+		poly1305_emit_simd(&state, &actual);
+		ASSERT(!memcmp(&expected, &actual, sizeof(actual)));
+#endif
+#ifdef __x86_64__
+		state = start;
+		poly1305_blocks_x86(&key, &state, data, nblocks, hibit, false);
+		poly1305_emit_simd(&state, &actual);
+		ASSERT(!memcmp(&expected, &actual, sizeof(actual)));
+#endif
+		for (i = 0; i < ARRAY_SIZE(states); i++) {
+			states[i] = start;
+			msgs[i] = data;
+		}
+		poly1305_blocks_multi(&key, states, msgs, nblocks, hibit,
+				      ARRAY_SIZE(states), iter % 2);
+		for (i = 0; i < ARRAY_SIZE(states); i++) {
+			poly1305_emit_generic(&states[i], &actual);
+			ASSERT(!memcmp(&expected, &actual, sizeof(actual)));
+		}
+	}
+}
+#endif
+
 void test_poly1305(void)
 {
+#if defined(HAVE_POLY1305_GENERIC64) || defined(HAVE_POLY1305_SIMD)
+	fuzz_poly1305();
+#endif
+
 #define ALGNAME		"Poly1305"
 #define HASH		_poly1305_generic
+#ifdef HAVE_POLY1305_GENERIC64
+#  define HASH_IMPL_NAME	"generic, base 2^44"
+#  define HASH_ALT		_poly1305_generic26
+#  define HASH_ALT_IMPL_NAME	"generic, base 2^26"
+#endif
 #ifdef HAVE_POLY1305_SIMD
 #  define HASH_SIMD	_poly1305_simd
 #endif
@@ -7,11 +7,21 @@
  */
 #pragma once
 
+#include "cpufeatures.h"
 #include "util.h"
 
 #define POLY1305_BLOCK_SIZE	16
 #define POLY1305_DIGEST_SIZE	16
 
+/*
+ * On 64-bit hosts, the generic code uses three 44-bit limbs and 64x64 => 128-bit
+ * multiplications instead of five 26-bit limbs.
+ */
+#undef HAVE_POLY1305_GENERIC64
+#if defined(__SIZEOF_INT128__)
+#  define HAVE_POLY1305_GENERIC64 1
+#endif
+
 struct poly1305_key {
 	u32 r[5];	/* base 2^26 */
 
@@ -20,6 +30,31 @@ struct poly1305_key {
 	 * for r^1, r^2, r^3, r^4
 	 */
 	u32 powers[4][9];
+
+#ifdef HAVE_POLY1305_GENERIC64
+	/* r0, r1, r2, 20*r1, 20*r2 in base 2^44, for r^1 and r^2 */
+	u64 powers44[2][5];
+
+	/* r0, r1, 5*r1/4 in base 2^64, for the fused NHPoly1305 code */
+	u64 r64[3];
+#endif
+
+#ifdef __x86_64__
+	/*
+	 * The same powers laid out for the x86_64 SIMD code: row j holds item j
+	 * of r^4, r^3, r^2, r^1, each zero-extended to a 64-bit lane.
+	 */
+	u64 powers_x86[9][4] __attribute__((aligned(32)));
+#endif
+
+#ifdef __aarch64__
+	/*
+	 * The same powers laid out for the ARM64 NEON code: row j holds item j
+	 * of r^2, r^2, r^2, r^1, so that the low half of each row is r^2 in
+	 * both lanes and the high half is r^2, r^1.
+	 */
+	u32 powers_arm64[9][4] __attribute__((aligned(16)));
+#endif
 };
 
 struct poly1305_state {
@@ -37,8 +72,32 @@ void poly1305_blocks_generic(const struct poly1305_key *key,
 			     struct poly1305_state *state,
 			     const u8 *data, size_t nblocks, u32 hibit);
 
+void poly1305_blocks_multi_generic(const struct poly1305_key *key,
+				   struct poly1305_state state[],
+				   const void * const data[], size_t nblocks,
+				   u32 hibit, unsigned int n);
+
 void poly1305_emit_generic(struct poly1305_state *state, le128 *out);
 
+#ifdef HAVE_POLY1305_GENERIC64
+/* Same as poly1305_blocks_generic(), but @hibit is 0 or 1 */
+void poly1305_blocks_generic64(const struct poly1305_key *key,
+			       struct poly1305_state *state,
+			       const u8 *data, size_t nblocks, u32 hibit);
+
+/* Same as poly1305_blocks_multi_generic(), but @hibit is 0 or 1 */
+void poly1305_blocks_multi_generic64(const struct poly1305_key *key,
+				     struct poly1305_state state[],
+				     const void * const data[], size_t nblocks,
+				     u32 hibit, unsigned int n);
+
+/*
+ * Convert a state in base 2^64, as left by the fused NHPoly1305 code, to the
+ * usual base 2^26.  h64[2] must be small, i.e. h < 2^133.
+ */
+void poly1305_h64_to_h26(const u64 h64[3], struct poly1305_state *state);
+#endif
+
 #undef HAVE_POLY1305_SIMD
 #ifdef __arm__
 #define HAVE_POLY1305_SIMD 1
@@ -61,7 +120,70 @@ static inline void poly1305_emit_simd(struct poly1305_state *state, le128 *out)
 {
 	poly1305_emit_neon(state->h, (u8 *)out);
 }
-#endif /* __arm__ */
+#elif defined(__x86_64__)
+#define HAVE_POLY1305_SIMD 1
+
+extern void poly1305_blocks_avx2(u32 h[5], const u8 *data, size_t nblocks,
+				 u32 hibit, const u64 powers[9][4]);
+extern void poly1305_blocks_sse2(u32 h[5], const u8 *data, size_t nblocks,
+				 u32 hibit, const u64 powers[9][4]);
+
+extern void poly1305_blocks_lanes_avx2(u64 h[5][4], const u8 * const data[4],
+				       size_t nblocks, u32 hibit,
+				       const u64 powers[9][4]);
+
+void poly1305_blocks_x86(const struct poly1305_key *key,
+			 struct poly1305_state *state, const void *data,
+			 size_t nblocks, u32 hibit, bool avx2);
+
+void poly1305_blocks_multi_x86(const struct poly1305_key *key,
+			       struct poly1305_state state[],
+			       const void * const data[], size_t nblocks,
+			       u32 hibit, unsigned int n, bool avx2);
+
+static inline void poly1305_blocks_simd(const struct poly1305_key *key,
+					struct poly1305_state *state,
+					const void *data, size_t nblocks,
+					u32 hibit)
+{
+	poly1305_blocks_x86(key, state, data, nblocks, hibit,
+			    cpu_have_features(X86_FEATURE_AVX2));
+}
+
+/* The x86_64 SIMD code keeps the state in the same form as the generic code */
+static inline void poly1305_emit_simd(struct poly1305_state *state, le128 *out)
+{
+	poly1305_emit_generic(state, out);
+}
+#elif defined(__aarch64__)
+#define HAVE_POLY1305_SIMD 1
+
+extern void poly1305_blocks_2lane_neon(u32 h[5], const u8 *data,
+				       size_t nblocks, u32 hibit,
+				       const u32 powers[9][4]);
+
+static inline void poly1305_blocks_simd(const struct poly1305_key *key,
+					struct poly1305_state *state,
+					const void *data, size_t nblocks,
+					u32 hibit)
+{
+	size_t n = round_down(nblocks, 2);
+
+	if (n)
+		poly1305_blocks_2lane_neon(state->h, data, n, hibit,
+					   key->powers_arm64);
+	if (nblocks > n)
+		poly1305_blocks_generic(key, state,
+					data + n * POLY1305_BLOCK_SIZE, 1,
+					hibit << 24);
+}
+
+/* The ARM64 NEON code keeps the state in the same form as the generic code */
+static inline void poly1305_emit_simd(struct poly1305_state *state, le128 *out)
+{
+	poly1305_emit_generic(state, out);
+}
+#endif /* __aarch64__ */
 
 static inline void poly1305_blocks(const struct poly1305_key *key,
 				   struct poly1305_state *state,
@@ -74,7 +196,52 @@ static inline void poly1305_blocks(const struct poly1305_key *key,
 		return;
 	}
 #endif
+#ifdef HAVE_POLY1305_GENERIC64
+	poly1305_blocks_generic64(key, state, data, nblocks, hibit);
+#else
 	poly1305_blocks_generic(key, state, data, nblocks, hibit << 24);
+#endif
+}
+
+/*
+ * Hash @nblocks blocks of each of @n independent messages with the same key,
+ * continuing from @state[i] for message i.
+ *
+ * The messages are hashed side by side, so that the multiplications for
+ * different messages can overlap: with AVX2, one message per SIMD lane, and
+ * otherwise in interleaved scalar code.  The latter is also used for SIMD on
+ * ARM64, where it makes better use of the 64-bit multiplier than the 2-lane
+ * NEON code does on the few blocks per message that Adiantum passes here.  On
+ * 32-bit ARM, the NEON code is still used one message at a time.
+ */
+static inline void poly1305_blocks_multi(const struct poly1305_key *key,
+					 struct poly1305_state state[],
+					 const void * const data[],
+					 size_t nblocks, u32 hibit,
+					 unsigned int n, bool simd)
+{
+#ifdef __x86_64__
+	if (simd) {
+		poly1305_blocks_multi_x86(key, state, data, nblocks, hibit, n,
+					  cpu_have_features(X86_FEATURE_AVX2));
+		return;
+	}
+#elif defined(HAVE_POLY1305_SIMD) && !defined(HAVE_POLY1305_GENERIC64)
+	if (simd) {
+		unsigned int i;
+
+		for (i = 0; i < n; i++)
+			poly1305_blocks_simd(key, &state[i], data[i], nblocks,
+					     hibit);
+		return;
+	}
+#endif
+#ifdef HAVE_POLY1305_GENERIC64
+	poly1305_blocks_multi_generic64(key, state, data, nblocks, hibit, n);
+#else
+	poly1305_blocks_multi_generic(key, state, data, nblocks, hibit << 24,
+				      n);
+#endif
 }
 
 static inline void poly1305_tail(const struct poly1305_key *key,
@@ -0,0 +1,217 @@
+/*
+ * Simple work-stealing thread pool
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include "threadpool.h"
+
+#include <pthread.h>
+
+/*
+ * Since jobs never create more jobs, each worker's queue is just a range of job
+ * indices.  The owner takes from the front and thieves take from the back, each
+ * under the queue's lock.  No thread ever holds two queue locks at once.
+ */
+struct worker {
+	struct thread_pool *pool;
+	unsigned int id;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	size_t begin;
+	size_t end;
+} __cacheline_aligned;
+
+struct thread_pool {
+	unsigned int nthreads;
+	struct worker *workers;
+
+	/* The current run; protected by 'lock' */
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	u64 generation;
+	unsigned int nbusy;
+	bool stop;
+	thread_pool_fn_t fn;
+	void *arg;
+	size_t grain;
+};
+
+/* Take up to 'grain' jobs from the front of the worker's own queue */
+static bool take_jobs(struct worker *w, size_t grain,
+		      size_t *begin, size_t *end)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->begin < w->end) {
+		*begin = w->begin;
+		*end = min(w->end, w->begin + grain);
+		w->begin = *end;
+		found = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return found;
+}
+
+/* Move the back half of some other worker's queue into our own */
+static bool steal_jobs(struct worker *w)
+{
+	struct thread_pool *pool = w->pool;
+	unsigned int i;
+
+	for (i = 1; i < pool->nthreads; i++) {
+		struct worker *victim =
+			&pool->workers[(w->id + i) % pool->nthreads];
+		size_t begin, end;
+
+		pthread_mutex_lock(&victim->lock);
+		end = victim->end;
+		begin = end - (end - victim->begin + 1) / 2;
+		victim->end = begin;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin < end) {
+			pthread_mutex_lock(&w->lock);
+			w->begin = begin;
+			w->end = end;
+			pthread_mutex_unlock(&w->lock);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void do_jobs(struct worker *w)
+{
+	struct thread_pool *pool = w->pool;
+	size_t begin, end;
+
+	do {
+		while (take_jobs(w, pool->grain, &begin, &end))
+			pool->fn(pool->arg, begin, end, w->id);
+	} while (steal_jobs(w));
+}
+
+static void *worker_thread(void *p)
+{
+	struct worker *w = p;
+	struct thread_pool *pool = w->pool;
+	u64 generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->generation == generation && !pool->stop)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->stop)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		do_jobs(w);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->nbusy == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct thread_pool *thread_pool_create(unsigned int nthreads)
+{
+	struct thread_pool *pool = calloc(1, sizeof(*pool));
+	unsigned int i;
+	int err;
+
+	ASSERT(pool != NULL);
+	ASSERT(nthreads >= 1);
+	pool->nthreads = nthreads;
+	err = posix_memalign((void **)&pool->workers,
+			     __alignof__(struct worker),
+			     nthreads * sizeof(struct worker));
+	ASSERT(err == 0);
+	memset(pool->workers, 0, nthreads * sizeof(struct worker));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &pool->workers[i];
+
+		w->pool = pool;
+		w->id = i;
+		pthread_mutex_init(&w->lock, NULL);
+		/* Worker 0 is whichever thread calls thread_pool_run() */
+		if (i != 0) {
+			err = pthread_create(&w->thread, NULL, worker_thread, w);
+			ASSERT(err == 0);
+		}
+	}
+	return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		if (i != 0)
+			pthread_join(pool->workers[i].thread, NULL);
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	}
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+unsigned int thread_pool_size(const struct thread_pool *pool)
+{
+	return pool->nthreads;
+}
+
+void thread_pool_run(struct thread_pool *pool, size_t njobs, size_t grain,
+		     thread_pool_fn_t fn, void *arg)
+{
+	const unsigned int n = pool->nthreads;
+	unsigned int i;
+
+	ASSERT(grain >= 1);
+
+	for (i = 0; i < n; i++) {
+		struct worker *w = &pool->workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		w->begin = njobs * i / n;
+		w->end = njobs * (i + 1) / n;
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->grain = grain;
+	pool->nbusy = n - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	do_jobs(&pool->workers[0]);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->nbusy != 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,35 @@
+/*
+ * Simple work-stealing thread pool
+ *
+ * Copyright (C) 2018 Google LLC
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#pragma once
+
+#include "util.h"
+
+struct thread_pool;
+
+/*
+ * Called with a range [begin, end) of job indices to run.  'worker' is the
+ * index of the calling worker, in [0, nthreads).
+ */
+typedef void (*thread_pool_fn_t)(void *arg, size_t begin, size_t end,
+				 unsigned int worker);
+
+/* Create a pool of @nthreads threads, including the thread calling *_run() */
+struct thread_pool *thread_pool_create(unsigned int nthreads);
+void thread_pool_destroy(struct thread_pool *pool);
+unsigned int thread_pool_size(const struct thread_pool *pool);
+
+/*
+ * Run jobs [0, @njobs) on the pool and wait for them all to finish.  Each
+ * worker starts with an equal contiguous share of the jobs and takes up to
+ * @grain of them at a time from the front of its share.  A worker that runs
+ * out steals the back half of the remaining share of another worker.
+ */
+void thread_pool_run(struct thread_pool *pool, size_t njobs, size_t grain,
+		     thread_pool_fn_t fn, void *arg);
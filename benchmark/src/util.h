@@ -14,6 +14,7 @@
 #endif
 
 #include <inttypes.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -70,6 +71,7 @@ typedef uint64_t u64;
 #define __round_mask(x, y)  ((__typeof__(x))((y)-1))
 #define round_up(x, y)      ((((x)-1) | __round_mask(x, y))+1)
 #define round_down(x, y)    ((x) & ~__round_mask(x, y))
+#define DIV_ROUND_UP(n, d)  (((n) + (d) - 1) / (d))
 
 __cold __noreturn void assertion_failed(const char *expr,
 					const char *file, int line);
@@ -183,6 +185,21 @@ static inline u64 now(void)
 	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
+/*
+ * A cheaper timestamp than now(), for timing single calls.  The unit depends
+ * on the CPU; convert differences to ns with ticks_to_ns().
+ */
+static inline u64 ticks(void)
+{
+#ifdef __x86_64__
+	return __builtin_ia32_rdtsc();
+#else
+	return now();
+#endif
+}
+
+u64 ticks_to_ns(u64 t);
+
 static inline void print_bytes(const char *prefix, const void *_p, size_t n)
 {
 	const u8 *p = _p;
@@ -198,6 +215,147 @@ extern u64 cpu_frequency_kHz;
 void show_result(const char *algname, const char *op, const char *impl,
 		 u64 nbytes, u64 ns_elapsed);
 
+/* Hardware events counted for each run of a benchmark, if possible */
+enum measure_counter {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_L1D_MISSES,
+	NUM_COUNTERS,
+};
+
+/*
+ * Open the performance counters, falling back to the TSC for cycles.  If the
+ * CPU frequency is unknown, the TSC frequency is used instead.
+ */
+void measure_init(void);
+/* How cycles are counted: "perf_event_open", "TSC", or NULL if they aren't */
+const char *measure_cycle_source(void);
+bool measure_have_counter(enum measure_counter counter);
+
+/*
+ * The times of the runs of one benchmark.  Starting from a zeroed struct, time
+ * each benchmark with:
+ *
+ *	measure_begin(&m);
+ *	while (measure_more(&m)) {
+ *		measure_start(&m);
+ *		...
+ *		measure_stop(&m);
+ *	}
+ *	show_measurement(algname, op, impl, nbytes, &m);
+ *
+ * and call measure_free() when done.  The first g_params.warmup runs are
+ * discarded.  After that, at least g_params.ntries runs are done, and then
+ * more until the 95% confidence interval of the mean is within
+ * g_params.ci_target percent of the mean, or until there have been
+ * g_params.max_ntries runs.
+ */
+struct measurement {
+	u64 *times;
+	u64 (*counts)[NUM_COUNTERS];
+	int ntimes;
+	int capacity;
+	int nwarmup;
+	u64 start_ns;
+	u64 start_counts[NUM_COUNTERS];
+	/*
+	 * Set if other threads do the work, so the time is all that can be
+	 * measured: the counters only count the calling thread.
+	 */
+	bool time_only;
+};
+
+struct measurement_stats {
+	int nsamples;		/* 0 if only best_ns is known */
+	int noutliers;		/* outside Tukey's fences */
+	u64 best_ns;
+	u64 p5_ns;
+	u64 median_ns;
+	u64 p95_ns;
+	double mean_ns;
+	double stddev_ns;
+	double ci_ns;		/* half-width of the 95% confidence interval */
+	/* Counts for the run with the fewest cycles; 0 if not counted */
+	u64 counts[NUM_COUNTERS];
+};
+
+void measure_begin(struct measurement *m);
+bool measure_more(const struct measurement *m);
+void measure_start(struct measurement *m);
+void measure_stop(struct measurement *m);
+void measure_get_stats(struct measurement *m, struct measurement_stats *stats);
+void measure_free(struct measurement *m);
+
+/* Like show_result(), but given the time of each run.  Sorts the times. */
+void show_measurement(const char *algname, const char *op, const char *impl,
+		      u64 nbytes, struct measurement *m);
+/*
+ * Like show_measurement(), but for messages of @msglen bytes regardless of
+ * g_params.bufsize.  These results are left out of the --bufsize-sweep report.
+ */
+void show_measurement_msglen(const char *algname, const char *op,
+			     const char *impl, int msglen, u64 nbytes,
+			     struct measurement *m);
+
+/*
+ * A histogram of the latencies of single calls, in ticks().  As in an HDR
+ * histogram, each power of 2 is split into LATENCY_SUB_BUCKETS linear buckets,
+ * so the relative error is under 1% for any value.
+ */
+#define LATENCY_SUB_BITS	7
+#define LATENCY_SUB_BUCKETS	(1 << LATENCY_SUB_BITS)
+#define LATENCY_NUM_BUCKETS	((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+struct latency_histogram {
+	u64 counts[LATENCY_NUM_BUCKETS];
+	u64 total;
+	u64 max;
+};
+
+struct latency_stats {
+	u64 ncalls;
+	double p50_ns;
+	double p99_ns;
+	double p999_ns;
+	double max_ns;
+};
+
+void latency_reset(struct latency_histogram *h);
+void latency_record(struct latency_histogram *h, u64 t);
+void latency_get_stats(const struct latency_histogram *h,
+		       struct latency_stats *stats);
+
+/* Show the latencies of calls that each process g_params.bufsize bytes */
+void show_latency(const char *algname, const char *op, const char *impl,
+		  const struct latency_histogram *h);
+
+/*
+ * Figures derived from a result, shown on a line of their own under it, or as
+ * more fields with --format=json or csv.  The unused ones are NAN or NULL.
+ */
+struct result_extra {
+	const char *item;	/* what ns_per_item is per, e.g. "subkey" */
+	double ns_per_item;
+	double efficiency_pct;	/* per-thread, vs. one thread */
+	double delta_pct;	/* the change vs. the result named 'baseline' */
+	const char *baseline;
+};
+
+#define RESULT_EXTRA_INIT \
+	{ .ns_per_item = NAN, .efficiency_pct = NAN, .delta_pct = NAN }
+
+/*
+ * Show the throughput @s of processing @nbytes, with the latencies @l of the
+ * requests (or NULL) and the derived figures @x (or NULL).  @msglen is as for
+ * show_measurement_msglen(), or 0 for g_params.bufsize.
+ */
+void show_result_extra(const char *algname, const char *op, const char *impl,
+		       int msglen, u64 nbytes,
+		       const struct measurement_stats *s,
+		       const struct latency_stats *l,
+		       const struct result_extra *x);
+
 static inline u64 KB_per_s(u64 bytes, u64 ns_elapsed)
 {
 	return bytes * 1000000000 / ns_elapsed / 1000;
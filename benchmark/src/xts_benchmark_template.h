@@ -20,11 +20,11 @@
 	KEY main_key;
 	KEY tweak_key;
 	unsigned long i, j;
-	int try;
-	const int ntries = g_params.ntries;
 	const unsigned long nbytes = round_up(1000000, bufsize);
+	struct measurement m = { 0 };
+	struct latency_histogram *lat = NULL;
 	u64 start;
-	u64 best_time;
+	int w;
 #if BLOCK_BYTES == 16
 #  define TWEAK_T	ble128
 #  define TWEAK_XOR	ble128_xor
@@ -37,6 +37,60 @@
 	TWEAK_T orig_t;
 	TWEAK_T t;
 
+#ifndef XTS_ENCRYPT_TWEAK
+#  define XTS_ENCRYPT_TWEAK	ENCRYPT
+#endif
+
+/* XTS-encrypt or XTS-decrypt one message using the generic code */
+#define XTS_CRYPT_GENERIC(crypt, dst, src)				\
+	do {								\
+		ENCRYPT(&tweak_key, (u8 *)&t, (u8 *)&orig_t);		\
+		for (j = 0; j < bufsize; j += sizeof(t)) {		\
+			TWEAK_T x;					\
+									\
+			memcpy(&x, &(src)[j], sizeof(x));		\
+			TWEAK_XOR(&x, &t);				\
+			crypt(&main_key, (u8 *)&x, (u8 *)&x);		\
+			TWEAK_XOR(&x, &t);				\
+			memcpy(&(dst)[j], &x, sizeof(x));		\
+			TWEAK_MUL_X(&t);				\
+		}							\
+	} while (0)
+
+/* Benchmark XTS encryption and decryption using a SIMD implementation */
+#define XTS_BENCHMARK_SIMD(encrypt_simd, decrypt_simd, impl_name)	\
+	do {								\
+		measure_begin(&m);					\
+		while (measure_more(&m)) {				\
+			measure_start(&m);				\
+			for (i = 0; i < nbytes; i += bufsize) {		\
+				XTS_ENCRYPT_TWEAK(&tweak_key, (u8 *)&t,	\
+						  (u8 *)&orig_t);	\
+				encrypt_simd(&main_key, ctext_simd,	\
+					     orig, bufsize, &t);	\
+			}						\
+			measure_stop(&m);				\
+			ASSERT(memcmp(orig, ctext_simd, bufsize));	\
+			ASSERT(!memcmp(ctext, ctext_simd, bufsize));	\
+		}							\
+		show_measurement(xts_algname, "encryption", (impl_name),\
+				 nbytes, &m);				\
+		measure_begin(&m);					\
+		while (measure_more(&m)) {				\
+			measure_start(&m);				\
+			for (i = 0; i < nbytes; i += bufsize) {		\
+				XTS_ENCRYPT_TWEAK(&tweak_key, (u8 *)&t,	\
+						  (u8 *)&orig_t);	\
+				decrypt_simd(&main_key, ptext,		\
+					     ctext_simd, bufsize, &t);	\
+			}						\
+			measure_stop(&m);				\
+			ASSERT(!memcmp(orig, ptext, bufsize));		\
+		}							\
+		show_measurement(xts_algname, "decryption", (impl_name),\
+				 nbytes, &m);				\
+	} while (0)
+
 	sprintf(xts_algname, "%s-XTS", ALGNAME);
 
 	ASSERT(sizeof(block) == sizeof(t));
@@ -55,80 +109,152 @@
 	ASSERT(!memcmp(block, block_orig, sizeof(block)));
 
 	/* XTS encryption (generic) */
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		start = now();
-		for (i = 0; i < nbytes; i += bufsize) {
-			ENCRYPT(&tweak_key, (u8 *)&t, (u8 *)&orig_t);
-			for (j = 0; j < bufsize; j += sizeof(t)) {
-				TWEAK_T x;
-
-				memcpy(&x, &orig[j], sizeof(x));
-				TWEAK_XOR(&x, &t);
-				ENCRYPT(&main_key, (u8 *)&x, (u8 *)&x);
-				TWEAK_XOR(&x, &t);
-				memcpy(&ctext[j], &x, sizeof(x));
-				TWEAK_MUL_X(&t);
-			}
-		}
-		best_time = min(best_time, now() - start);
+	measure_begin(&m);
+	while (measure_more(&m)) {
+		measure_start(&m);
+		for (i = 0; i < nbytes; i += bufsize)
+			XTS_CRYPT_GENERIC(ENCRYPT, ctext, orig);
+		measure_stop(&m);
 	}
 	ASSERT(memcmp(orig, ctext, bufsize));
-	show_result(xts_algname, "encryption", "generic", nbytes, best_time);
+	show_measurement(xts_algname, "encryption", "generic", nbytes, &m);
 
 	/* XTS decryption (generic) */
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		start = now();
-		for (i = 0; i < nbytes; i += bufsize) {
-			ENCRYPT(&tweak_key, (u8 *)&t, (u8 *)&orig_t);
-			for (j = 0; j < bufsize; j += sizeof(t)) {
-				TWEAK_T x;
-
-				memcpy(&x, &ctext[j], sizeof(x));
-				TWEAK_XOR(&x, &t);
-				DECRYPT(&main_key, (u8 *)&x, (u8 *)&x);
-				TWEAK_XOR(&x, &t);
-				memcpy(&ptext[j], &x, sizeof(x));
-				TWEAK_MUL_X(&t);
-			}
-		}
-		best_time = min(best_time, now() - start);
+	measure_begin(&m);
+	while (measure_more(&m)) {
+		measure_start(&m);
+		for (i = 0; i < nbytes; i += bufsize)
+			XTS_CRYPT_GENERIC(DECRYPT, ptext, ctext);
+		measure_stop(&m);
 	}
 	ASSERT(!memcmp(orig, ptext, bufsize));
-	show_result(xts_algname, "decryption", "generic", nbytes, best_time);
+	show_measurement(xts_algname, "decryption", "generic", nbytes, &m);
+
+#ifdef XTS_ENCRYPT_SIMD
+#ifndef XTS_SIMD_USABLE
+#  define XTS_SIMD_USABLE	true
+#endif
+#ifndef XTS_SIMD_IMPL_NAME
+#  define XTS_SIMD_IMPL_NAME	SIMD_IMPL_NAME
+#endif
+	if (XTS_SIMD_USABLE)
+		XTS_BENCHMARK_SIMD(XTS_ENCRYPT_SIMD, XTS_DECRYPT_SIMD,
+				   XTS_SIMD_IMPL_NAME);
+#endif /* XTS_ENCRYPT_SIMD */
+#ifdef XTS_ENCRYPT_SIMD_ALT
+	if (XTS_SIMD_ALT_USABLE)
+		XTS_BENCHMARK_SIMD(XTS_ENCRYPT_SIMD_ALT, XTS_DECRYPT_SIMD_ALT,
+				   XTS_SIMD_ALT_IMPL_NAME);
+#endif
 
+	/* The latency of single messages */
+	if (g_params.latency_calls) {
+		lat = malloc(sizeof(*lat));
+		latency_reset(lat);
+		for (i = 0; i < g_params.latency_calls; i++) {
+			start = ticks();
+			XTS_CRYPT_GENERIC(ENCRYPT, ctext, orig);
+			latency_record(lat, ticks() - start);
+		}
+		show_latency(xts_algname, "encryption", "generic", lat);
+		latency_reset(lat);
+		for (i = 0; i < g_params.latency_calls; i++) {
+			start = ticks();
+			XTS_CRYPT_GENERIC(DECRYPT, ptext, ctext);
+			latency_record(lat, ticks() - start);
+		}
+		show_latency(xts_algname, "decryption", "generic", lat);
+	}
 #ifdef XTS_ENCRYPT_SIMD
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		start = now();
-		for (i = 0; i < nbytes; i += bufsize) {
-			ENCRYPT(&tweak_key, (u8 *)&t, (u8 *)&orig_t);
+	if (g_params.latency_calls && XTS_SIMD_USABLE) {
+		latency_reset(lat);
+		for (i = 0; i < g_params.latency_calls; i++) {
+			start = ticks();
+			XTS_ENCRYPT_TWEAK(&tweak_key, (u8 *)&t, (u8 *)&orig_t);
 			XTS_ENCRYPT_SIMD(&main_key, ctext_simd, orig, bufsize,
 					 &t);
+			latency_record(lat, ticks() - start);
 		}
-		best_time = min(best_time, now() - start);
-		ASSERT(memcmp(orig, ctext_simd, bufsize));
-		ASSERT(!memcmp(ctext, ctext_simd, bufsize));
-	}
-	show_result(xts_algname, "encryption", SIMD_IMPL_NAME, nbytes,
-		    best_time);
-	best_time = UINT64_MAX;
-	for (try = 0; try < ntries; try++) {
-		start = now();
-		for (i = 0; i < nbytes; i += bufsize) {
-			ENCRYPT(&tweak_key, (u8 *)&t, (u8 *)&orig_t);
+		show_latency(xts_algname, "encryption", XTS_SIMD_IMPL_NAME,
+			     lat);
+		latency_reset(lat);
+		for (i = 0; i < g_params.latency_calls; i++) {
+			start = ticks();
+			XTS_ENCRYPT_TWEAK(&tweak_key, (u8 *)&t, (u8 *)&orig_t);
 			XTS_DECRYPT_SIMD(&main_key, ptext, ctext_simd, bufsize,
 					 &t);
+			latency_record(lat, ticks() - start);
 		}
-		best_time = min(best_time, now() - start);
-		ASSERT(!memcmp(orig, ptext, bufsize));
+		show_latency(xts_algname, "decryption", XTS_SIMD_IMPL_NAME,
+			     lat);
 	}
-	show_result(xts_algname, "decryption", SIMD_IMPL_NAME, nbytes,
-		    best_time);
 #endif /* XTS_ENCRYPT_SIMD */
+
+	/*
+	 * XTS encryption of consecutive messages in source and destination
+	 * buffers that together are the size of each working set
+	 */
+	for (w = 0; w < g_params.num_working_sets; w++) {
+		const size_t nmsgs = max(g_params.working_sets[w].size / 2 /
+					 bufsize, (size_t)1);
+		const unsigned long ws_nbytes = max(nbytes, nmsgs * bufsize);
+		u8 *ws_src = malloc(nmsgs * bufsize);
+		u8 *ws_dst = malloc(nmsgs * bufsize);
+		char label[64];
+		char impl_name[128];
+		size_t k;
+
+		ASSERT(ws_src != NULL && ws_dst != NULL);
+		memset(ws_src, 0x5a, nmsgs * bufsize);
+		memset(ws_dst, 0, nmsgs * bufsize);
+		working_set_label(&g_params.working_sets[w], label,
+				  sizeof(label));
+
+		measure_begin(&m);
+		while (measure_more(&m)) {
+			measure_start(&m);
+			for (i = 0, k = 0; i < ws_nbytes; i += bufsize) {
+				XTS_CRYPT_GENERIC(ENCRYPT, &ws_dst[k * bufsize],
+						  &ws_src[k * bufsize]);
+				if (++k == nmsgs)
+					k = 0;
+			}
+			measure_stop(&m);
+		}
+		sprintf(impl_name, "generic, %s", label);
+		show_measurement(xts_algname, "encryption", impl_name,
+				 ws_nbytes, &m);
+#ifdef XTS_ENCRYPT_SIMD
+		if (XTS_SIMD_USABLE) {
+			measure_begin(&m);
+			while (measure_more(&m)) {
+				measure_start(&m);
+				for (i = 0, k = 0; i < ws_nbytes;
+				     i += bufsize) {
+					XTS_ENCRYPT_TWEAK(&tweak_key, (u8 *)&t,
+							  (u8 *)&orig_t);
+					XTS_ENCRYPT_SIMD(&main_key,
+							 &ws_dst[k * bufsize],
+							 &ws_src[k * bufsize],
+							 bufsize, &t);
+					if (++k == nmsgs)
+						k = 0;
+				}
+				measure_stop(&m);
+			}
+			sprintf(impl_name, "%s, %s", XTS_SIMD_IMPL_NAME,
+				label);
+			show_measurement(xts_algname, "encryption", impl_name,
+					 ws_nbytes, &m);
+		}
+#endif
+		free(ws_src);
+		free(ws_dst);
+	}
 	putchar('\n');
 
+	measure_free(&m);
+	free(lat);
 	free(orig);
 	free(ctext);
 #ifdef XTS_ENCRYPT_SIMD
@@ -140,6 +266,8 @@
 #undef TWEAK_T
 #undef TWEAK_XOR
 #undef TWEAK_MUL_X
+#undef XTS_CRYPT_GENERIC
+#undef XTS_BENCHMARK_SIMD
 
 #undef ALGNAME
 #undef KEY_BYTES
@@ -150,3 +278,10 @@
 /* #undef DECRYPT */
 #undef XTS_ENCRYPT_SIMD
 #undef XTS_DECRYPT_SIMD
+#undef XTS_SIMD_USABLE
+#undef XTS_SIMD_IMPL_NAME
+#undef XTS_ENCRYPT_SIMD_ALT
+#undef XTS_DECRYPT_SIMD_ALT
+#undef XTS_SIMD_ALT_USABLE
+#undef XTS_SIMD_ALT_IMPL_NAME
+#undef XTS_ENCRYPT_TWEAK